@@ -55,6 +55,8 @@ namespace UTJ
                 conf.height = m_scratch_buffer.height;
                 conf.num_colors = Mathf.Clamp(m_numColors, 1, 256);
                 conf.max_active_tasks = 0;
+                conf.task_priority = fcAPI.fcTaskPriority.Realtime;
+                conf.non_blocking = false;
                 m_ctx = fcAPI.fcGifCreateContext(ref conf);
             }
 
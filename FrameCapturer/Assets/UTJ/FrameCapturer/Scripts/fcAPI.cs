@@ -55,16 +55,78 @@ namespace UTJ
             InProgress,
         };
 
+        public enum fcTaskPriority
+        {
+            Realtime,
+            Background,
+        };
+
 
         [DllImport ("FrameCapturer")] public static extern void         fcSetModulePath(string path);
         [DllImport ("FrameCapturer")] public static extern double       fcGetTime();
 
+        public struct fcThreadPoolConfig
+        {
+            public int num_workers;
+            public ulong affinity_mask;
+            public int priority;
+            [MarshalAs(UnmanagedType.LPStr)] public string name_prefix;
+
+            public static fcThreadPoolConfig default_value
+            {
+                get
+                {
+                    return new fcThreadPoolConfig
+                    {
+                        num_workers = 0,
+                        affinity_mask = 0,
+                        priority = 0,
+                        name_prefix = "fc",
+                    };
+                }
+            }
+        };
+        // must be called before any exporter context is created
+        [DllImport ("FrameCapturer")] public static extern Bool         fcSetThreadPoolConfig(ref fcThreadPoolConfig conf);
+
         public struct fcStream { public IntPtr ptr; }
         [DllImport ("FrameCapturer")] public static extern fcStream     fcCreateFileStream(string path);
+        [DllImport ("FrameCapturer")] public static extern fcStream     fcCreateAsyncFileStream(string path, UIntPtr max_pending_bytes);
+        [DllImport ("FrameCapturer")] public static extern fcStream     fcCreateMappedFileStream(string path, UIntPtr window_size);
         [DllImport ("FrameCapturer")] public static extern fcStream     fcCreateMemoryStream();
+        [DllImport ("FrameCapturer")] public static extern fcStream     fcCreateSegmentedMemoryStream(UIntPtr segment_size);
         [DllImport ("FrameCapturer")] public static extern void         fcDestroyStream(fcStream s);
+        [DllImport ("FrameCapturer")] public static extern void         fcStreamFlush(fcStream s);
+        [DllImport ("FrameCapturer")] public static extern Bool         fcStreamFailed(fcStream s);
         [DllImport ("FrameCapturer")] public static extern ulong        fcStreamGetWrittenSize(fcStream s);
 
+        public struct fcBufferData
+        {
+            public IntPtr data;
+            public UIntPtr size;
+        };
+        [DllImport ("FrameCapturer")] public static extern int          fcStreamGetNumSegments(fcStream s);
+        [DllImport ("FrameCapturer")] public static extern fcBufferData fcStreamGetSegment(fcStream s, int i);
+
+        public enum fcJobState
+        {
+            Pending,
+            Succeeded,
+            Failed,
+        };
+        public struct fcJob { public IntPtr ptr; }
+        // called from a worker thread after the fc*Async() call has returned.
+        // keep a reference to the delegate (e.g. in a static field) until the job is finished, otherwise GC may collect it
+        // while the native side still holds the function pointer. IL2CPP can call back only static methods
+        // marked with [AOT.MonoPInvokeCallback(typeof(fcJobCallback))]; pass state through userdata.
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate void fcJobCallback(fcJob job, fcJobState state, IntPtr userdata);
+        [DllImport ("FrameCapturer")] public static extern fcJobState   fcJobPoll(fcJob job);
+        [DllImport ("FrameCapturer")] public static extern fcJobState   fcJobWait(fcJob job, int timeout_ms = -1);
+        [DllImport ("FrameCapturer")] public static extern void         fcJobRelease(fcJob job);
+        // src and dst must be kept alive (pinned) until the job is finished
+        [DllImport ("FrameCapturer")] public static extern fcJob        fcConvertPixelFormatAsync(IntPtr dst, fcPixelFormat dstfmt, IntPtr src, fcPixelFormat srcfmt, int num_pixels, fcJobCallback cb, IntPtr userdata);
+
         [DllImport ("FrameCapturer")] public static extern void         fcGuardBegin();
         [DllImport ("FrameCapturer")] public static extern void         fcGuardEnd();
         [DllImport ("FrameCapturer")] public static extern void         fcEraseDeferredCall(int id);
@@ -133,9 +195,49 @@ namespace UTJ
         // PNG Exporter
         // -------------------------------------------------------------
 
+        public enum fcPngPreset
+        {
+            Balanced,
+            Fastest,
+            Smallest,
+        };
+        public enum fcPngStrategy
+        {
+            Preset = -1,
+            Default = 0,
+            Filtered = 1,
+            HuffmanOnly = 2,
+            RLE = 3,
+            Fixed = 4,
+        };
+        [Flags]
+        public enum fcPngFilter
+        {
+            Preset  = 0,
+            None    = 1 << 0,
+            Sub     = 1 << 1,
+            Up      = 1 << 2,
+            Average = 1 << 3,
+            Paeth   = 1 << 4,
+            All     = 0x1f,
+        };
+        public enum fcPngBackend
+        {
+            Zlib,
+            Fast,
+        };
+
         public struct fcPngConfig
         {
             public int max_active_tasks;
+            public fcTaskPriority task_priority;
+            public Bool non_blocking;
+            public Bool parallel_encoding;
+            public fcPngPreset preset;
+            public int compression_level; // 0-9. -1: by preset
+            public fcPngStrategy compression_strategy;
+            public fcPngFilter filters;
+            public fcPngBackend backend;
 
             public static fcPngConfig default_value
             {
@@ -144,6 +246,14 @@ namespace UTJ
                     return new fcPngConfig
                     {
                         max_active_tasks = 0,
+                        task_priority = fcTaskPriority.Realtime,
+                        non_blocking = false,
+                        parallel_encoding = false,
+                        preset = fcPngPreset.Balanced,
+                        compression_level = -1,
+                        compression_strategy = fcPngStrategy.Preset,
+                        filters = fcPngFilter.Preset,
+                        backend = fcPngBackend.Zlib,
                     };
                 }
             }
@@ -152,7 +262,16 @@ namespace UTJ
 
         [DllImport ("FrameCapturer")] public static extern fcPNGContext fcPngCreateContext(ref fcPngConfig conf);
         [DllImport ("FrameCapturer")] public static extern void         fcPngDestroyContext(fcPNGContext ctx);
+        [DllImport ("FrameCapturer")] public static extern int          fcPngGetActiveTaskCount(fcPNGContext ctx);
+        [DllImport ("FrameCapturer")] public static extern fcJob        fcPngExportPixelsAsync(fcPNGContext ctx, string path, IntPtr pixels, int width, int height, fcPixelFormat f, Bool flipY, fcJobCallback cb, IntPtr userdata);
         [DllImport ("FrameCapturer")] private static extern int         fcPngExportTextureDeferred(fcPNGContext ctx, string path, IntPtr tex, int width, int height, fcPixelFormat f, Bool flipY, int id);
+        [DllImport ("FrameCapturer")] public static extern fcJob        fcPngExportPixelsToStreamAsync(fcPNGContext ctx, fcStream stream, IntPtr pixels, int width, int height, fcPixelFormat f, Bool flipY, fcJobCallback cb, IntPtr userdata);
+        // data is valid only during the call. called on a worker thread after fcPngExportPixelsToCallback() has returned,
+        // so the same rules as fcJobCallback apply: keep the delegate referenced until the callback has fired,
+        // and use a static [AOT.MonoPInvokeCallback(typeof(fcPngDataCallback))] method on IL2CPP.
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        public delegate void fcPngDataCallback(IntPtr data, UIntPtr size, IntPtr userdata);
+        [DllImport ("FrameCapturer")] public static extern Bool         fcPngExportPixelsToCallback(fcPNGContext ctx, fcPngDataCallback data_cb, IntPtr data_userdata, IntPtr pixels, int width, int height, fcPixelFormat f, Bool flipY);
 
         public static int fcPngExportTexture(fcPNGContext ctx, string path, RenderTexture tex, int pos)
         {
@@ -168,6 +287,8 @@ namespace UTJ
         public struct fcExrConfig
         {
             public int max_active_tasks;
+            public fcTaskPriority task_priority;
+            public Bool non_blocking;
 
             public static fcExrConfig default_value
             {
@@ -176,6 +297,8 @@ namespace UTJ
                     return new fcExrConfig
                     {
                         max_active_tasks = 0,
+                        task_priority = fcTaskPriority.Background,
+                        non_blocking = false,
                     };
                 }
             }
@@ -184,6 +307,8 @@ namespace UTJ
 
         [DllImport ("FrameCapturer")] public static extern fcEXRContext fcExrCreateContext(ref fcExrConfig conf);
         [DllImport ("FrameCapturer")] public static extern void         fcExrDestroyContext(fcEXRContext ctx);
+        [DllImport ("FrameCapturer")] public static extern int          fcExrGetActiveTaskCount(fcEXRContext ctx);
+        [DllImport ("FrameCapturer")] public static extern fcJob        fcExrEndFrameAsync(fcEXRContext ctx, fcJobCallback cb, IntPtr userdata);
         [DllImport ("FrameCapturer")] private static extern int         fcExrBeginFrameDeferred(fcEXRContext ctx, string path, int width, int height, int id);
         [DllImport ("FrameCapturer")] private static extern int         fcExrAddLayerTextureDeferred(fcEXRContext ctx, IntPtr tex, fcPixelFormat f, int ch, string name, Bool flipY, int id);
         [DllImport ("FrameCapturer")] private static extern int         fcExrEndFrameDeferred(fcEXRContext ctx, int id);
@@ -214,6 +339,8 @@ namespace UTJ
             public int height;
             public int num_colors;
             public int max_active_tasks;
+            public fcTaskPriority task_priority;
+            public Bool non_blocking;
 
             public static fcGifConfig default_value
             {
@@ -225,6 +352,8 @@ namespace UTJ
                         height = 240,
                         num_colors = 256,
                         max_active_tasks = 0,
+                        task_priority = fcTaskPriority.Realtime,
+                        non_blocking = false,
                     };
                 }
             }
@@ -233,6 +362,7 @@ namespace UTJ
 
         [DllImport ("FrameCapturer")] public static extern fcGIFContext fcGifCreateContext(ref fcGifConfig conf);
         [DllImport ("FrameCapturer")] public static extern void         fcGifDestroyContext(fcGIFContext ctx);
+        [DllImport ("FrameCapturer")] public static extern fcJob        fcGifAddFramePixelsAsync(fcGIFContext ctx, IntPtr pixels, fcPixelFormat fmt, Bool keyframe, double timestamp, fcJobCallback cb, IntPtr userdata);
         [DllImport ("FrameCapturer")] private static extern int         fcGifAddFrameTextureDeferred(fcGIFContext ctx, IntPtr tex, fcPixelFormat fmt, Bool keyframe, double timestamp, int id);
         [DllImport ("FrameCapturer")] public static extern Bool         fcGifWrite(fcGIFContext ctx, fcStream stream, int begin_frame=0, int end_frame=-1);
 
@@ -275,6 +405,9 @@ namespace UTJ
             public int audio_sampling_rate;
             public int audio_num_channels;
             public int audio_bitrate;
+            public Bool video_non_blocking;
+            public int output_max_queued_frames;
+            public Bool output_non_blocking;
 
             public static fcMP4Config default_value
             {
@@ -294,6 +427,9 @@ namespace UTJ
                         audio_sampling_rate = 48000,
                         audio_num_channels = 2,
                         audio_bitrate = 64000,
+                        video_non_blocking = false,
+                        output_max_queued_frames = 0,
+                        output_non_blocking = false,
                     };
                 }
             }
@@ -309,6 +445,7 @@ namespace UTJ
         [DllImport ("FrameCapturer")] public static extern void             fcMP4AddOutputStream(fcMP4Context ctx, fcStream s);
         [DllImport ("FrameCapturer")] private static extern IntPtr          fcMP4GetAudioEncoderInfo(fcMP4Context ctx);
         [DllImport ("FrameCapturer")] private static extern IntPtr          fcMP4GetVideoEncoderInfo(fcMP4Context ctx);
+        [DllImport ("FrameCapturer")] public static extern fcJob            fcMP4AddVideoFramePixelsAsync(fcMP4Context ctx, IntPtr pixels, fcPixelFormat fmt, double time, fcJobCallback cb, IntPtr userdata);
         [DllImport ("FrameCapturer")] private static extern int             fcMP4AddVideoFrameTextureDeferred(fcMP4Context ctx, IntPtr tex, fcPixelFormat fmt, double time, int id);
         [DllImport ("FrameCapturer")] public static extern Bool             fcMP4AddAudioFrame(fcMP4Context ctx, float[] samples, int num_samples, double time = -1.0);
 
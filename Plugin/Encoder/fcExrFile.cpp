@@ -48,18 +48,19 @@ public:
     bool beginFrame(const char *path, int width, int height) override;
     bool addLayerTexture(void *tex, fcPixelFormat fmt, int channel, const char *name, bool flipY) override;
     bool addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name, bool flipY) override;
-    bool endFrame() override;
+    bool endFrame(fcJob *job) override;
+    int getActiveTaskCount() override;
 
 private:
     bool addLayerImpl(char *pixels, fcPixelFormat fmt, int channel, const char *name);
-    void endFrameTask(fcExrTaskData *exr);
+    bool endFrameTask(fcExrTaskData *exr);
 
 private:
     fcExrConfig m_conf;
     fcIGraphicsDevice *m_dev;
     fcExrTaskData *m_task;
     fcTaskGroup m_tasks;
-    std::atomic_int m_active_task_count;
+    std::unique_ptr<fcSemaphore> m_slots;
 
     const void *m_frame_prev;
     Buffer *m_src_prev;
@@ -71,7 +72,6 @@ fcExrContext::fcExrContext(const fcExrConfig& conf, fcIGraphicsDevice *dev)
     : m_conf()
     , m_dev(dev)
     , m_task(nullptr)
-    , m_active_task_count(0)
     , m_frame_prev(nullptr)
     , m_src_prev(nullptr)
     , m_fmt_prev()
@@ -80,6 +80,7 @@ fcExrContext::fcExrContext(const fcExrConfig& conf, fcIGraphicsDevice *dev)
     if (m_conf.max_active_tasks <= 0) {
         m_conf.max_active_tasks = std::thread::hardware_concurrency();
     }
+    m_slots.reset(new fcSemaphore(m_conf.max_active_tasks));
 }
 
 fcExrContext::~fcExrContext()
@@ -100,15 +101,17 @@ bool fcExrContext::beginFrame(const char *path, int width, int height)
         return false;
     }
 
-    // 実行中のタスクの数が上限に達している場合適当に待つ
-    if (m_active_task_count >= m_conf.max_active_tasks)
-    {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        if (m_active_task_count >= m_conf.max_active_tasks)
-        {
-            m_tasks.wait();
+    // 実行中のタスクの数が上限に達している場合、スロットが1つ空くまで待つ (non_blocking なら失敗)
+    // スロットは endFrameTask() の完了時に解放される
+    if (m_conf.non_blocking) {
+        if (!m_slots->tryAcquire()) {
+            fcDebugLog("fcExrContext::beginFrame(): all slots are in use.");
+            return false;
         }
     }
+    else {
+        m_slots->acquire();
+    }
 
     m_task = new fcExrTaskData(path, width, height);
     return true;
@@ -146,9 +149,6 @@ bool fcExrContext::addLayerTexture(void *tex, fcPixelFormat fmt, int channel, co
             m_task->pixels.pop_back();
             return false;
         }
-        if (flipY) {
-            fcImageFlipY(&(*raw_frame)[0], m_task->width, m_task->height, fmt);
-        }
         m_src_prev = raw_frame;
 
         // convert pixel format if it is not supported by exr
@@ -160,10 +160,13 @@ bool fcExrContext::addLayerTexture(void *tex, fcPixelFormat fmt, int channel, co
             auto src_fmt = fmt;
             fmt = fcPixelFormat(fcPixelFormat_Type_f16 | channels);
             buf->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-            fcConvertPixelFormat(&(*buf)[0], fmt, &(*raw_frame)[0], src_fmt, m_task->width * m_task->height);
+            fcConvertPixelFormatImageParallel(&(*buf)[0], fmt, 0, &(*raw_frame)[0], src_fmt, 0, m_task->width, m_task->height, flipY);
 
             m_src_prev = raw_frame = buf;
         }
+        else if (flipY) {
+            fcImageFlipY(&(*raw_frame)[0], m_task->width, m_task->height, fmt);
+        }
 
         m_fmt_prev = fmt;
     }
@@ -198,14 +201,12 @@ bool fcExrContext::addLayerPixels(const void *pixels, fcPixelFormat fmt, int cha
             auto src_fmt = fmt;
             fmt = fcPixelFormat(fcPixelFormat_Type_f16 | channels);
             raw_frame->resize(m_task->width * m_task->height * (2 * channels));
-            fcConvertPixelFormat(&(*raw_frame)[0], fmt, pixels, src_fmt, m_task->width * m_task->height);
+            fcConvertPixelFormatImageParallel(&(*raw_frame)[0], fmt, 0, pixels, src_fmt, 0, m_task->width, m_task->height, flipY);
         }
         else {
+            // copy (and flip)
             raw_frame->resize(m_task->width * m_task->height * fcGetPixelSize(fmt));
-            memcpy(&(*raw_frame)[0], pixels, raw_frame->size());
-        }
-        if (flipY) {
-            fcImageFlipY(&(*raw_frame)[0], m_task->width, m_task->height, fmt);
+            fcConvertPixelFormatImageParallel(&(*raw_frame)[0], fmt, 0, pixels, fmt, 0, m_task->width, m_task->height, flipY);
         }
 
         m_src_prev = raw_frame;
@@ -246,7 +247,7 @@ bool fcExrContext::addLayerImpl(char *pixels, fcPixelFormat fmt, int channel, co
 }
 
 
-bool fcExrContext::endFrame()
+bool fcExrContext::endFrame(fcJob *job)
 {
     if (m_task == nullptr) {
         fcDebugLog("fcExrContext::endFrame(): maybe beginFrame() is not called.");
@@ -257,24 +258,45 @@ bool fcExrContext::endFrame()
 
     fcExrTaskData *exr = m_task;
     m_task = nullptr;
-    ++m_active_task_count;
-    m_tasks.run([this, exr](){
-        endFrameTask(exr);
-        --m_active_task_count;
-    });
+    if (job) { job->addRef(); }
+    m_tasks.run([this, exr, job](){
+        bool succeeded = endFrameTask(exr);
+        m_slots->release();
+        if (job) {
+            job->complete(succeeded);
+            job->release();
+        }
+    }, m_conf.task_priority);
     return true;
 }
 
-void fcExrContext::endFrameTask(fcExrTaskData *exr)
+int fcExrContext::getActiveTaskCount()
 {
+    return m_conf.max_active_tasks - m_slots->getCount();
+}
+
+bool fcExrContext::endFrameTask(fcExrTaskData *exr)
+{
+    // OpenEXR reports errors (bad path, disk full etc.) by Iex::BaseExc, that is a std::exception.
+    // nothing must escape from the pool task
+    std::unique_ptr<fcExrTaskData> holder(exr);
     try {
         Imf::OutputFile fout(exr->path.c_str(), exr->header);
         fout.setFrameBuffer(exr->frame_buffer);
         fout.writePixels(exr->height);
-        delete exr;
+        return true;
     }
-    catch (std::string &e) {
-        fcDebugLog(e.c_str());
+    catch (const std::exception &e) {
+        fcDebugLog("fcExrContext::endFrameTask(): %s", e.what());
+        return false;
+    }
+    catch (const std::string &e) {
+        fcDebugLog("fcExrContext::endFrameTask(): %s", e.c_str());
+        return false;
+    }
+    catch (...) {
+        fcDebugLog("fcExrContext::endFrameTask(): unknown exception");
+        return false;
     }
 }
 
@@ -8,7 +8,9 @@ public:
     virtual bool beginFrame(const char *path, int width, int height) = 0;
     virtual bool addLayerTexture(void *tex, fcPixelFormat fmt, int channel, const char *name, bool flipY) = 0;
     virtual bool addLayerPixels(const void *pixels, fcPixelFormat fmt, int channel, const char *name, bool flipY) = 0;
-    virtual bool endFrame() = 0;
+    // job (optional) is completed when the file is written
+    virtual bool endFrame(fcJob *job = nullptr) = 0;
+    virtual int getActiveTaskCount() = 0;
 protected:
     virtual ~fcIExrContext() {}
 };
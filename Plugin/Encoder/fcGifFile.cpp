@@ -24,6 +24,9 @@ struct fcGifTaskData
     int frame;
     bool local_palette;
     fcTime timestamp;
+    fcJob *job;
+
+    fcGifTaskData() : raw_pixel_format(), gif_frame(), frame(), local_palette(), timestamp(), job() {}
 };
 
 class fcGifContext : public fcIGifContext
@@ -34,7 +37,7 @@ public:
     void release() override;
 
     bool addFrameTexture(void *tex, fcPixelFormat fmt, bool keyframe, fcTime timestamp) override;
-    bool addFramePixels(const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp) override;
+    bool addFramePixels(const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp, fcJob *job) override;
     bool write(fcStream& stream, int begin_frame, int end_frame) override;
 
     void clearFrame() override;
@@ -44,7 +47,8 @@ public:
     void eraseFrame(int begin_frame, int end_frame) override;
 
 private:
-    fcGifTaskData&  getTempraryVideoFrame();
+    // nullptr if non_blocking and all buffers are in use
+    fcGifTaskData*  getTempraryVideoFrame();
     void            returnTempraryVideoFrame(fcGifTaskData& v);
 
     void addGifFrame(fcGifTaskData& data);
@@ -54,11 +58,10 @@ private:
     fcGifConfig m_conf;
     fcIGraphicsDevice *m_dev;
     std::vector<fcGifTaskData> m_buffers;
-    std::vector<fcGifTaskData*> m_buffers_unused;
+    fcFreeList<fcGifTaskData> m_buffers_unused;
     std::list<fcGifFrame> m_gif_frames;
     jo_gif_t m_gif;
     fcTaskGroup m_tasks;
-    std::mutex m_mutex;
     int m_frame;
 };
 
@@ -78,8 +81,8 @@ fcGifContext::fcGifContext(const fcGifConfig &conf, fcIGraphicsDevice *dev)
     for (auto& buf : m_buffers)
     {
         buf.rgba8_pixels.resize(m_conf.width * m_conf.height * fcGetPixelSize(fcPixelFormat_RGBAu8));
-        m_buffers_unused.push_back(&buf);
     }
+    m_buffers_unused.reset(m_buffers.data(), (int)m_buffers.size());
 }
 
 fcGifContext::~fcGifContext()
@@ -108,30 +111,22 @@ static inline void advance_palette_and_pop_front(std::list<jo_gif_frame_t>& fram
     frames.pop_front();
 }
 
-fcGifTaskData& fcGifContext::getTempraryVideoFrame()
+fcGifTaskData* fcGifContext::getTempraryVideoFrame()
 {
-    fcGifTaskData *ret = nullptr;
-
     // wait if all temporaries are in use
-    for (;;) {
-        {
-            std::unique_lock<std::mutex> lock(m_mutex);
-            if (!m_buffers_unused.empty()) {
-                ret = m_buffers_unused.back();
-                m_buffers_unused.pop_back();
-                break;
-            }
+    if (m_conf.non_blocking) {
+        auto *ret = m_buffers_unused.tryAcquire();
+        if (!ret) {
+            fcDebugLog("fcGifContext::getTempraryVideoFrame(): all buffers are in use. frame is dropped.");
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return ret;
     }
-
-    return *ret;
+    return m_buffers_unused.acquire();
 }
 
 void fcGifContext::returnTempraryVideoFrame(fcGifTaskData& v)
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
-    m_buffers_unused.push_back(&v);
+    m_buffers_unused.release(&v);
 }
 
 void fcGifContext::addGifFrame(fcGifTaskData& data)
@@ -148,7 +143,14 @@ void fcGifContext::addGifFrame(fcGifTaskData& data)
     }
 
     jo_gif_frame(&m_gif, data.gif_frame, src, data.frame, data.local_palette);
+
+    fcJob *job = data.job;
+    data.job = nullptr;
     returnTempraryVideoFrame(data);
+    if (job) {
+        job->complete(true);
+        job->release();
+    }
 }
 
 void fcGifContext::kickTask(fcGifTaskData& data)
@@ -168,7 +170,7 @@ void fcGifContext::kickTask(fcGifTaskData& data)
     {
         m_tasks.run([this, &data]() {
             addGifFrame(data);
-        });
+        }, m_conf.task_priority);
     }
 }
 
@@ -178,7 +180,9 @@ bool fcGifContext::addFrameTexture(void *tex, fcPixelFormat fmt, bool keyframe,
         fcDebugLog("fcGifContext::addFrameTexture(): gfx device is null.");
         return false;
     }
-    fcGifTaskData& data = getTempraryVideoFrame();
+    fcGifTaskData *pdata = getTempraryVideoFrame();
+    if (!pdata) { return false; }
+    fcGifTaskData& data = *pdata;
     data.timestamp = timestamp >= 0.0 ? timestamp : GetCurrentTimeSec();
     data.local_palette = data.frame == 0 || keyframe;
 
@@ -187,6 +191,7 @@ bool fcGifContext::addFrameTexture(void *tex, fcPixelFormat fmt, bool keyframe,
     data.raw_pixel_format = fmt;
     if (!m_dev->readTexture(&data.raw_pixels[0], data.raw_pixels.size(), tex, m_conf.width, m_conf.height, fmt))
     {
+        returnTempraryVideoFrame(data);
         return false;
     }
 
@@ -194,13 +199,17 @@ bool fcGifContext::addFrameTexture(void *tex, fcPixelFormat fmt, bool keyframe,
     return true;
 }
 
-bool fcGifContext::addFramePixels(const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp)
+bool fcGifContext::addFramePixels(const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp, fcJob *job)
 {
-    fcGifTaskData& data = getTempraryVideoFrame();
+    fcGifTaskData *pdata = getTempraryVideoFrame();
+    if (!pdata) { return false; }
+    fcGifTaskData& data = *pdata;
     data.timestamp = timestamp >= 0.0 ? timestamp : GetCurrentTimeSec();
     data.local_palette = data.frame == 0 || keyframe;
     data.raw_pixel_format = fmt;
     data.raw_pixels.assign((char*)pixels, m_conf.width * m_conf.height * fcGetPixelSize(fmt));
+    if (job) { job->addRef(); }
+    data.job = job;
 
     kickTask(data);
     return true;
@@ -254,8 +263,9 @@ bool fcGifContext::write(fcStream& os, int begin_frame, int end_frame)
         jo_gif_write_frame(os, &m_gif, &(*i), pal, frame++, duration);
     }
     jo_gif_write_footer(os, &m_gif);
+    os.flush();
 
-    return true;
+    return !os.failed();
 }
 
 
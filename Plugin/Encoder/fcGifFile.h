@@ -7,7 +7,8 @@ public:
     virtual void release() = 0;
 
     virtual bool addFrameTexture(void *tex, fcPixelFormat fmt, bool keyframe, fcTime timestamp = -1) = 0;
-    virtual bool addFramePixels(const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp = -1) = 0;
+    // job (optional) is completed when the frame is encoded
+    virtual bool addFramePixels(const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp = -1, fcJob *job = nullptr) = 0;
     virtual bool write(fcStream& stream, int begin_frame, int end_frame) = 0;
 
     virtual void clearFrame() = 0;
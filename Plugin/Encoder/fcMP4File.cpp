@@ -1,7 +1,7 @@
 ﻿#include "pch.h"
 #include <libyuv/libyuv.h>
-#include "fcThreadPool.h"
 #include "fcMP4Internal.h"
+#include "fcThreadPool.h"
 #include "fcMP4File.h"
 #include "fcH264Encoder.h"
 #include "fcAACEncoder.h"
@@ -26,7 +26,7 @@ public:
 
     void addOutputStream(fcStream *s) override;
     bool addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime timestamp) override;
-    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamps) override;
+    bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamps, fcJob *job) override;
     bool addAudioFrame(const float *samples, int num_samples, fcTime timestamp) override;
 
 private:
@@ -34,19 +34,23 @@ private:
     typedef std::pair<fcAudioFrame, fcAACFrame> AudioFrame;
     typedef std::unique_ptr<fcMP4StreamWriter> StreamWriterPtr;
 
-    void enqueueVideoTask(const std::function<void()> &f);
-    void enqueueAudioTask(const std::function<void()> &f);
+    void enqueueVideoTask(fcTask &&task);
+    void enqueueAudioTask(fcTask &&task);
     void processVideoTasks();
     void processAudioTasks();
 
-    VideoFrame& getTempraryVideoFrame();
+    // nullptr if video_non_blocking and all buffers are in use
+    VideoFrame* getTempraryVideoFrame();
     void        returnTempraryVideoFrame(VideoFrame& v);
     AudioFrame& getTempraryAudioFrame();
     void        returnTempraryAudioFrame(AudioFrame& v);
 
     void resetEncoders();
     void waitAllTasksFinished();
-    void encodeVideoFrame(VideoFrame& vf, bool rgba2i420);
+    bool encodeVideoFrame(VideoFrame& vf, bool rgba2i420);
+    // copy the encoded frame once and hand it to all streams. each stream writes it on its own I/O thread.
+    // return false if any stream dropped the frame or has failed to write.
+    template<class Frame> bool publishFrame(const Frame& frame);
 
     template<class Body>
     void eachStreams(const Body &b)
@@ -61,8 +65,8 @@ private:
 
     std::vector<VideoFrame>     m_tmp_video_frames;
     std::vector<AudioFrame>     m_tmp_audio_frames;
-    std::vector<VideoFrame*>    m_tmp_video_frames_unused;
-    std::vector<AudioFrame*>    m_tmp_audio_frames_unused;
+    fcFreeList<VideoFrame>      m_tmp_video_frames_unused;
+    fcFreeList<AudioFrame>      m_tmp_audio_frames_unused;
 
     std::unique_ptr<fcIH264Encoder> m_h264_encoder;
     std::unique_ptr<fcIAACEncoder> m_aac_encoder;
@@ -72,13 +76,13 @@ private:
     std::thread m_video_worker;
     std::mutex m_video_mutex;
     std::condition_variable m_video_condition;
-    std::deque<std::function<void()>> m_video_tasks;
+    fcTaskRing m_video_tasks;
 
     std::atomic_int m_audio_active_task_count;
     std::thread m_audio_worker;
     std::mutex m_audio_mutex;
     std::condition_variable m_audio_condition;
-    std::deque<std::function<void()>> m_audio_tasks;
+    fcTaskRing m_audio_tasks;
 
 #ifndef fcMaster
     std::unique_ptr<StdIOStream> m_dbg_h264_out;
@@ -104,18 +108,22 @@ fcMP4Context::fcMP4Context(fcMP4Config &conf, fcIGraphicsDevice *dev)
         m_tmp_video_frames.resize(m_conf.video_max_buffers);
         for (auto& v : m_tmp_video_frames) {
             v.first.allocate(m_conf.video_width, m_conf.video_height);
-            m_tmp_video_frames_unused.push_back(&v);
         }
+        m_tmp_video_frames_unused.reset(m_tmp_video_frames.data(), (int)m_tmp_video_frames.size());
 
-        m_video_worker = std::thread([this]() { processVideoTasks(); });
+        m_video_worker = std::thread([this]() {
+            fcApplyWorkerThreadConfig("MP4Video");
+            processVideoTasks();
+        });
     }
     if (m_conf.audio) {
         m_tmp_audio_frames.resize(m_conf.video_max_buffers);
-        for (auto& v : m_tmp_audio_frames) {
-            m_tmp_audio_frames_unused.push_back(&v);
-        }
+        m_tmp_audio_frames_unused.reset(m_tmp_audio_frames.data(), (int)m_tmp_audio_frames.size());
 
-        m_audio_worker = std::thread([this]() { processAudioTasks(); });
+        m_audio_worker = std::thread([this]() {
+            fcApplyWorkerThreadConfig("MP4Audio");
+            processAudioTasks();
+        });
     }
 
 #ifndef fcMaster
@@ -155,6 +163,7 @@ fcMP4Context::~fcMP4Context()
     m_dbg_aac_out.reset();
 #endif // fcMaster
 
+    // writers flush their queues before closing
     m_streams.clear();
 }
 
@@ -198,20 +207,20 @@ void fcMP4Context::resetEncoders()
     }
 }
 
-void fcMP4Context::enqueueVideoTask(const std::function<void()> &f)
+void fcMP4Context::enqueueVideoTask(fcTask &&task)
 {
     {
         std::unique_lock<std::mutex> lock(m_video_mutex);
-        m_video_tasks.push_back(std::function<void()>(f));
+        m_video_tasks.push_back(std::move(task));
     }
     m_video_condition.notify_one();
 }
 
-void fcMP4Context::enqueueAudioTask(const std::function<void()> &f)
+void fcMP4Context::enqueueAudioTask(fcTask &&task)
 {
     {
         std::unique_lock<std::mutex> lock(m_audio_mutex);
-        m_audio_tasks.push_back(std::function<void()>(f));
+        m_audio_tasks.push_back(std::move(task));
     }
     m_audio_condition.notify_one();
 }
@@ -224,56 +233,33 @@ void fcMP4Context::waitAllTasksFinished()
 }
 
 
-fcMP4Context::VideoFrame& fcMP4Context::getTempraryVideoFrame()
+fcMP4Context::VideoFrame* fcMP4Context::getTempraryVideoFrame()
 {
-    VideoFrame *ret = nullptr;
-
     // wait if all temporaries are in use
-    for (;;) {
-        {
-            std::unique_lock<std::mutex> lock(m_video_mutex);
-            if (!m_tmp_video_frames_unused.empty()) {
-                ret = m_tmp_video_frames_unused.back();
-                m_tmp_video_frames_unused.pop_back();
-                break;
-            }
+    if (m_conf.video_non_blocking) {
+        auto *ret = m_tmp_video_frames_unused.tryAcquire();
+        if (!ret) {
+            fcDebugLog("fcMP4Context::getTempraryVideoFrame(): all buffers are in use. frame is dropped.");
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return ret;
     }
-
-    return *ret;
+    return m_tmp_video_frames_unused.acquire();
 }
 
 void fcMP4Context::returnTempraryVideoFrame(VideoFrame& v)
 {
-    std::unique_lock<std::mutex> lock(m_video_mutex);
-    m_tmp_video_frames_unused.push_back(&v);
+    m_tmp_video_frames_unused.release(&v);
 }
 
 fcMP4Context::AudioFrame& fcMP4Context::getTempraryAudioFrame()
 {
-    AudioFrame *ret = nullptr;
-
-    // wait if all temporaries are in use
-    for (;;) {
-        {
-            std::unique_lock<std::mutex> lock(m_audio_mutex);
-            if (!m_tmp_audio_frames_unused.empty()) {
-                ret = m_tmp_audio_frames_unused.back();
-                m_tmp_audio_frames_unused.pop_back();
-                break;
-            }
-        }
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
-
-    return *ret;
+    // wait if all temporaries are in use. audio is never dropped.
+    return *m_tmp_audio_frames_unused.acquire();
 }
 
 void fcMP4Context::returnTempraryAudioFrame(AudioFrame& v)
 {
-    std::unique_lock<std::mutex> lock(m_audio_mutex);
-    m_tmp_audio_frames_unused.push_back(&v);
+    m_tmp_audio_frames_unused.release(&v);
 }
 
 
@@ -281,7 +267,7 @@ void fcMP4Context::processVideoTasks()
 {
     while (!m_stop)
     {
-        std::function<void()> task;
+        fcTask task;
         {
             std::unique_lock<std::mutex> lock(m_video_mutex);
             while (!m_stop && m_video_tasks.empty()) {
@@ -289,8 +275,7 @@ void fcMP4Context::processVideoTasks()
             }
             if (m_stop) { return; }
 
-            task = m_video_tasks.front();
-            m_video_tasks.pop_front();
+            task = m_video_tasks.pop_front();
         }
         task();
     }
@@ -300,7 +285,7 @@ void fcMP4Context::processAudioTasks()
 {
     while (!m_stop)
     {
-        std::function<void()> task;
+        fcTask task;
         {
             std::unique_lock<std::mutex> lock(m_audio_mutex);
             while (!m_stop && m_audio_tasks.empty()) {
@@ -308,8 +293,7 @@ void fcMP4Context::processAudioTasks()
             }
             if (m_stop) { return; }
 
-            task = m_audio_tasks.front();
-            m_audio_tasks.pop_front();
+            task = m_audio_tasks.pop_front();
         }
         task();
     }
@@ -342,7 +326,20 @@ void fcMP4Context::addOutputStream(fcStream *s)
     m_streams.emplace_back(StreamWriterPtr(writer));
 }
 
-void fcMP4Context::encodeVideoFrame(VideoFrame& vf, bool rgba2i420)
+template<class Frame>
+bool fcMP4Context::publishFrame(const Frame& frame)
+{
+    if (frame.data.empty() || m_streams.empty()) { return true; }
+
+    bool ret = true;
+    fcFramePtr packet = std::make_shared<Frame>(frame);
+    eachStreams([&](auto& s) {
+        if (!s.addFrame(packet)) { ret = false; }
+    });
+    return ret;
+}
+
+bool fcMP4Context::encodeVideoFrame(VideoFrame& vf, bool rgba2i420)
 {
     auto& raw = vf.first;
     auto& h264 = vf.second;
@@ -365,12 +362,13 @@ void fcMP4Context::encodeVideoFrame(VideoFrame& vf, bool rgba2i420)
     // I420 のピクセルデータを H264 へエンコード
     h264.clear();
     h264.timestamp = raw.timestamp;
-    m_h264_encoder->encode(h264, raw.i420, raw.timestamp);
+    bool succeeded = m_h264_encoder->encode(h264, raw.i420, raw.timestamp);
 
-    eachStreams([&](auto& s) { s.addFrame(h264); });
+    if (!publishFrame(h264)) { succeeded = false; }
 #ifndef fcMaster
     m_dbg_h264_out->write(h264.data.ptr(), h264.data.size());
 #endif // fcMaster
+    return succeeded;
 }
 
 
@@ -385,7 +383,9 @@ bool fcMP4Context::addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime tim
         return false;
     }
 
-    VideoFrame& vf = getTempraryVideoFrame();
+    VideoFrame *pvf = getTempraryVideoFrame();
+    if (!pvf) { return false; }
+    VideoFrame& vf = *pvf;
     auto& raw = vf.first;
     auto& h264 = vf.second;
     raw.timestamp = timestamp >= 0.0 ? timestamp : GetCurrentTimeSec();
@@ -406,12 +406,15 @@ bool fcMP4Context::addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime tim
             returnTempraryVideoFrame(vf);
             return false;
         }
-        fcConvertPixelFormat(raw.rgba.ptr(), fcPixelFormat_RGBAu8, &raw.raw[0], fmt, m_conf.video_width * m_conf.video_height);
+        // conversion is done by the encoder task, not on the calling (render) thread
     }
 
     // h264 データを生成
     ++m_video_active_task_count;
-    enqueueVideoTask([this, &vf](){
+    enqueueVideoTask([this, &vf, fmt](){
+        if (fmt != fcPixelFormat_RGBAu8) {
+            fcConvertPixelFormatParallel(vf.first.rgba.ptr(), fcPixelFormat_RGBAu8, &vf.first.raw[0], fmt, m_conf.video_width * m_conf.video_height);
+        }
         encodeVideoFrame(vf, true);
         returnTempraryVideoFrame(vf);
         --m_video_active_task_count;
@@ -420,14 +423,16 @@ bool fcMP4Context::addVideoFrameTexture(void *tex, fcPixelFormat fmt, fcTime tim
     return true;
 }
 
-bool fcMP4Context::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp)
+bool fcMP4Context::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcJob *job)
 {
     if (m_h264_encoder == nullptr) {
         fcDebugLog("fcMP4Context::addVideoFramePixels(): h264 encoder is null.");
         return false;
     }
 
-    VideoFrame& vf = getTempraryVideoFrame();
+    VideoFrame *pvf = getTempraryVideoFrame();
+    if (!pvf) { return false; }
+    VideoFrame& vf = *pvf;
     auto& raw = vf.first;
     auto& h264 = vf.second;
     raw.timestamp = timestamp >= 0.0 ? timestamp : GetCurrentTimeSec();
@@ -448,15 +453,20 @@ bool fcMP4Context::addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fc
         memcpy(raw.rgba.ptr(), pixels, raw.rgba.size());
     }
     else {
-        fcConvertPixelFormat(raw.rgba.ptr(), fcPixelFormat_RGBAu8, pixels, fmt, m_conf.video_width * m_conf.video_height);
+        fcConvertPixelFormatParallel(raw.rgba.ptr(), fcPixelFormat_RGBAu8, pixels, fmt, m_conf.video_width * m_conf.video_height);
     }
 
     // h264 データを生成
     ++m_video_active_task_count;
-    enqueueVideoTask([this, &vf, rgba2i420](){
-        encodeVideoFrame(vf, rgba2i420);
+    if (job) { job->addRef(); }
+    enqueueVideoTask([this, &vf, rgba2i420, job](){
+        bool succeeded = encodeVideoFrame(vf, rgba2i420);
         returnTempraryVideoFrame(vf);
         --m_video_active_task_count;
+        if (job) {
+            job->complete(succeeded);
+            job->release();
+        }
     });
 
     return true;
@@ -490,7 +500,7 @@ bool fcMP4Context::addAudioFrame(const float *samples, int num_samples, fcTime t
 
         m_aac_encoder->encode(aac, (float*)raw.data.ptr(), raw.data.size() / sizeof(float));
 
-        eachStreams([&](auto& s) { s.addFrame(aac); });
+        publishFrame(aac);
 #ifndef fcMaster
         m_dbg_aac_out->write(aac.data.ptr(), aac.data.size());
 #endif // fcMaster
@@ -17,7 +17,8 @@ public:
 
     // assume pixel format is RGBA8 or I420 (color_space indicates)
     // timestamp=-1 is treated as current time.
-    virtual bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1) = 0;
+    // job (optional) is completed when the frame is encoded and passed to the output streams.
+    virtual bool addVideoFramePixels(const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1, fcJob *job = nullptr) = 0;
 
     // timestamp=-1 is treated as current time.
     virtual bool addAudioFrame(const float *samples, int num_samples, fcTime timestamp = -1) = 0;
@@ -38,6 +38,7 @@ struct fcVideoFrame
     void deallocate()
     {
         rgba.clear();
+        rgba.shrink_to_fit();
         AlignedFree(i420.y);
         AlignedFree(i420.u);
         AlignedFree(i420.v);
@@ -152,6 +153,9 @@ struct fcAACFrame : public fcFrameData
     }
 };
 
+// encoded packet shared by all output streams. published once, released when the last stream has written it.
+typedef std::shared_ptr<const fcFrameData> fcFramePtr;
+
 
 struct fcFrameInfo
 {
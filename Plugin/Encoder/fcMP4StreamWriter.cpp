@@ -1,9 +1,11 @@
 #include "pch.h"
 #include <openh264/codec_api.h>
 #include "fcMP4Internal.h"
+#include "fcThreadPool.h"
 #include "fcMP4StreamWriter.h"
 
 #define fcMP464BitLength
+#define fcMP4DefaultMaxQueuedFrames 64
 
 
 namespace {
@@ -45,12 +47,28 @@ fcMP4StreamWriter::fcMP4StreamWriter(BinaryStream& stream, const fcMP4Config &co
     : m_stream(stream)
     , m_conf(conf)
     , m_mdat_begin(), m_mdat_end()
+    , m_stop(false), m_drop_video(false), m_failed(false)
 {
+    if (m_conf.output_max_queued_frames <= 0) {
+        m_conf.output_max_queued_frames = fcMP4DefaultMaxQueuedFrames;
+    }
     mp4Begin();
+
+    m_thread = std::thread([this]() {
+        fcApplyWorkerThreadConfig("MP4Output");
+        processFrames();
+    });
 }
 
 fcMP4StreamWriter::~fcMP4StreamWriter()
 {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond_pushed.notify_all();
+    m_thread.join();
+
     mp4End();
 }
 
@@ -76,11 +94,64 @@ void fcMP4StreamWriter::mp4Begin()
         ;
 }
 
-void fcMP4StreamWriter::addFrame(const fcFrameData& frame)
+bool fcMP4StreamWriter::addFrame(const fcFramePtr& frame)
 {
-    if (frame.data.empty()) { return; }
+    if (!frame || frame->data.empty()) { return true; }
+
+    bool is_video = frame->type == fcFrameType_H264;
+    bool ret = true;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (is_video && m_drop_video) {
+            // following P frames can't be decoded without the dropped one. resume at the next key frame.
+            auto h264_type = ((const fcH264Frame&)*frame).h264_type;
+            if (h264_type != fcH264FrameType_IDR && h264_type != fcH264FrameType_I) { return false; }
+            m_drop_video = false;
+        }
 
-    std::unique_lock<std::mutex> lock(m_mutex);
+        if ((int)m_queue.size() >= m_conf.output_max_queued_frames) {
+            if (m_conf.output_non_blocking) {
+                fcDebugLog("fcMP4StreamWriter::addFrame(): queue is full. frame is dropped.");
+                if (is_video) { m_drop_video = true; }
+                return false;
+            }
+            while ((int)m_queue.size() >= m_conf.output_max_queued_frames) {
+                m_cond_popped.wait(lock);
+            }
+        }
+        m_queue.push_back(frame);
+        if (m_failed) { ret = false; }
+    }
+    m_cond_pushed.notify_one();
+    return ret;
+}
+
+void fcMP4StreamWriter::processFrames()
+{
+    for (;;) {
+        fcFramePtr frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stop && m_queue.empty()) {
+                m_cond_pushed.wait(lock);
+            }
+            // write all queued frames before exit
+            if (m_queue.empty()) { return; }
+
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        m_cond_popped.notify_one();
+        writeFrame(*frame);
+        if (m_stream.failed()) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_failed = true;
+        }
+    }
+}
+
+void fcMP4StreamWriter::writeFrame(const fcFrameData& frame)
+{
     BinaryStream& os = m_stream;
 
     // video frame
@@ -606,5 +677,6 @@ void fcMP4StreamWriter::mp4End()
         bs.seekp(pos);
     }
 
+    bs.flush();
     fcDebugLog("fcMP4StreamWriter::mp4End() done.\n");
 }
@@ -1,22 +1,28 @@
 #ifndef fcMP4StreamWriter_h
 #define fcMP4StreamWriter_h
 
+// writes encoded frames to a stream on its own I/O thread.
+// frames are queued (up to conf.output_max_queued_frames), so a slow stream doesn't stall the encoders or other streams.
 class fcMP4StreamWriter
 {
 public:
     fcMP4StreamWriter(BinaryStream &stream, const fcMP4Config &conf);
-    virtual ~fcMP4StreamWriter();
-    void addFrame(const fcFrameData& buf); // thread safe
+    virtual ~fcMP4StreamWriter(); // writes all queued frames and the moov box
+    // thread safe. if the queue is full, wait until the I/O thread catches up,
+    // or drop the frame if conf.output_non_blocking. return false if the frame is dropped
+    // or if writing to the stream has failed (the frame is still queued in that case).
+    bool addFrame(const fcFramePtr& frame);
     void setAACEncoderInfo(const Buffer& aacheader);
 
 private:
     void mp4Begin();
     void mp4End();
+    void processFrames();
+    void writeFrame(const fcFrameData& frame);
 
 private:
     BinaryStream& m_stream;
     fcMP4Config m_conf;
-    std::mutex m_mutex;
     std::vector<fcFrameInfo> m_video_frame_info;
     std::vector<fcFrameInfo> m_audio_frame_info;
     std::vector<u8> m_pps;
@@ -26,6 +32,15 @@ private:
 
     size_t m_mdat_begin;
     size_t m_mdat_end;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_pushed;
+    std::condition_variable m_cond_popped;
+    std::deque<fcFramePtr> m_queue;
+    bool m_stop;
+    bool m_drop_video; // a video frame was dropped. drop until the next key frame
+    bool m_failed; // the stream has failed to write
 };
 
 #endif // fcMP4StreamWriter_h
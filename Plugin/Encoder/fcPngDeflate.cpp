@@ -0,0 +1,408 @@
+#include "pch.h"
+#include "fcFoundation.h"
+#include "fcPngDeflate.h"
+#include <algorithm>
+
+namespace {
+
+const int MinMatch = 4; // hash is made from 4 bytes. deflate allows 3, but 3 byte matches rarely pay
+const int MaxMatch = 258;
+const int WindowSize = 32768;
+const int HashBits = 15;
+const size_t MaxSymbolsPerBlock = 1 << 16;
+const int MaxStoredBlockSize = 65535;
+
+const int NumLitLenCodes = 286;
+const int NumDistCodes = 30;
+const int NumCodeLengthCodes = 19;
+
+const uint16_t LengthBase[29] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+const uint8_t LengthExtra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+const uint16_t DistBase[30] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+const uint8_t DistExtra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+const uint8_t CodeLengthOrder[19] = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+const uint8_t CodeLengthExtra[19] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,3,7 };
+
+// length -> length code (0-28), distance -> distance code (0-29)
+struct CodeTables
+{
+    uint8_t len_code[MaxMatch + 1];
+    uint8_t dist_code[512]; // [0, 256): distance - 1. [256, 512): 256 + ((distance - 1) >> 7)
+
+    CodeTables()
+    {
+        for (int c = 0; c < 29; ++c) {
+            int end = c == 28 ? MaxMatch + 1 : LengthBase[c + 1];
+            for (int l = LengthBase[c]; l < end; ++l) { len_code[l] = uint8_t(c); }
+        }
+        for (int c = 0; c < 30; ++c) {
+            int end = c == 29 ? WindowSize + 1 : DistBase[c + 1];
+            for (int d = DistBase[c]; d < end; ++d) {
+                if (d <= 256) { dist_code[d - 1] = uint8_t(c); }
+                else { dist_code[256 + ((d - 1) >> 7)] = uint8_t(c); }
+            }
+        }
+    }
+
+    int getDistCode(int d) const { return d <= 256 ? dist_code[d - 1] : dist_code[256 + ((d - 1) >> 7)]; }
+};
+
+const CodeTables& GetCodeTables()
+{
+    static const CodeTables s_tables;
+    return s_tables;
+}
+
+typedef fcPngFastDeflateWork::Symbol Symbol;
+
+class BitWriter
+{
+public:
+    BitWriter(Buffer& dst, size_t reserve) : m_dst(dst), m_pos(0), m_bits(0), m_count(0)
+    {
+        m_dst.resize(std::max<size_t>(reserve, 1024));
+    }
+
+    // LSB first
+    void put(uint32_t v, int n)
+    {
+        m_bits |= (uint64_t)v << m_count;
+        m_count += n;
+        if (m_count >= 32) {
+            reserve(4);
+            uint32_t b = (uint32_t)m_bits;
+            memcpy(&m_dst[m_pos], &b, 4); // little endian
+            m_pos += 4;
+            m_bits >>= 32;
+            m_count -= 32;
+        }
+    }
+
+    void align()
+    {
+        if (m_count % 8 != 0) { put(0, 8 - m_count % 8); }
+    }
+
+    // must be aligned
+    void putBytes(const void *data, size_t size)
+    {
+        flushBits();
+        reserve(size);
+        memcpy(&m_dst[m_pos], data, size);
+        m_pos += size;
+    }
+
+    // flush and shrink dst to the written size
+    void finish()
+    {
+        align();
+        flushBits();
+        m_dst.resize(m_pos);
+    }
+
+private:
+    void reserve(size_t n)
+    {
+        if (m_pos + n > m_dst.size()) { m_dst.resize(std::max<size_t>(m_dst.size() * 2, m_pos + n)); }
+    }
+
+    void flushBits()
+    {
+        reserve(8);
+        while (m_count > 0) {
+            m_dst[m_pos++] = char(m_bits & 0xff);
+            m_bits >>= 8;
+            m_count -= 8;
+        }
+        m_bits = 0;
+        m_count = 0;
+    }
+
+    Buffer& m_dst;
+    size_t m_pos;
+    uint64_t m_bits;
+    int m_count;
+};
+
+// huffman code lengths limited to max_bits. frequencies are flattened until the tree fits.
+// work: freq, nodes, leaf_symbols, depth and queue are used
+void BuildCodeLengths(const uint32_t *freq, int n, int max_bits, uint8_t *lengths, fcPngFastDeflateWork& work)
+{
+    typedef fcPngFastDeflateWork::Item Item;
+    auto& f = work.freq;
+    auto& nodes = work.nodes;
+    auto& leaf_symbols = work.leaf_symbols;
+    auto& depth = work.depth;
+    auto& queue = work.queue; // min heap, as std::priority_queue with std::greater
+    auto push = [&queue](Item item) {
+        queue.push_back(item);
+        std::push_heap(queue.begin(), queue.end(), std::greater<Item>());
+    };
+    auto pop = [&queue]() {
+        std::pop_heap(queue.begin(), queue.end(), std::greater<Item>());
+        Item item = queue.back();
+        queue.pop_back();
+        return item;
+    };
+
+    f.assign(freq, freq + n);
+    for (;;) {
+        nodes.clear();
+        leaf_symbols.clear();
+        queue.clear();
+        for (int s = 0; s < n; ++s) {
+            if (f[s] == 0) { continue; }
+            push(Item(f[s], (int)nodes.size()));
+            nodes.push_back({ f[s], -1 });
+            leaf_symbols.push_back(s);
+        }
+        size_t num_leaves = nodes.size();
+        while (queue.size() > 1) {
+            Item a = pop();
+            Item b = pop();
+            int parent = (int)nodes.size();
+            nodes.push_back({ a.first + b.first, -1 });
+            nodes[a.second].parent = parent;
+            nodes[b.second].parent = parent;
+            push(Item(a.first + b.first, parent));
+        }
+
+        // parents are always created after their children
+        depth.assign(nodes.size(), 0);
+        int max_depth = 0;
+        for (int i = (int)nodes.size() - 1; i >= 0; --i) {
+            if (nodes[i].parent >= 0) { depth[i] = depth[nodes[i].parent] + 1; }
+            if (size_t(i) < num_leaves) { max_depth = std::max(max_depth, depth[i]); }
+        }
+        if (max_depth <= max_bits) {
+            memset(lengths, 0, n);
+            for (size_t i = 0; i < num_leaves; ++i) { lengths[leaf_symbols[i]] = uint8_t(std::max(depth[i], 1)); }
+            return;
+        }
+        for (auto& v : f) {
+            if (v) { v = (v >> 1) | 1; }
+        }
+    }
+}
+
+// canonical codes, bit-reversed to be written LSB first
+void BuildCodes(const uint8_t *lengths, int n, uint16_t *codes)
+{
+    int bl_count[16] = {};
+    for (int i = 0; i < n; ++i) { ++bl_count[lengths[i]]; }
+    bl_count[0] = 0;
+    int next_code[16] = {};
+    int code = 0;
+    for (int bits = 1; bits < 16; ++bits) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < n; ++i) {
+        int len = lengths[i];
+        if (len == 0) { codes[i] = 0; continue; }
+        int c = next_code[len]++;
+        int r = 0;
+        for (int b = 0; b < len; ++b) { r = (r << 1) | ((c >> b) & 1); }
+        codes[i] = uint16_t(r);
+    }
+}
+
+// deflate requires complete codes for more than one symbol. make sure at least two are used
+void EnsureTwoSymbols(uint32_t *freq, int n)
+{
+    int used = 0;
+    for (int i = 0; i < n && used < 2; ++i) { used += freq[i] != 0; }
+    for (int i = 0; i < n && used < 2; ++i) {
+        if (freq[i] == 0) { freq[i] = 1; ++used; }
+    }
+}
+
+void WriteStoredBlocks(BitWriter& bw, const uint8_t *raw, size_t size, bool final)
+{
+    do {
+        size_t n = std::min<size_t>(size, MaxStoredBlockSize);
+        bool last = n == size;
+        bw.put(final && last ? 1 : 0, 1);
+        bw.put(0, 2); // stored
+        bw.align();
+        uint16_t header[2] = { uint16_t(n), uint16_t(~n) };
+        bw.putBytes(header, 4);
+        bw.putBytes(raw, n);
+        raw += n;
+        size -= n;
+    } while (size > 0);
+}
+
+// write symbols as a dynamic huffman block, or stored blocks if smaller. raw: the input the symbols represent
+void WriteBlock(BitWriter& bw, const uint8_t *raw, size_t raw_size, bool final, fcPngFastDeflateWork& work)
+{
+    const auto& tables = GetCodeTables();
+    const auto& symbols = work.symbols;
+
+    uint32_t lit_freq[NumLitLenCodes] = {};
+    uint32_t dist_freq[NumDistCodes] = {};
+    for (auto& s : symbols) {
+        if (s.dist == 0) {
+            ++lit_freq[s.lit_or_len];
+        }
+        else {
+            ++lit_freq[257 + tables.len_code[s.lit_or_len]];
+            ++dist_freq[tables.getDistCode(s.dist)];
+        }
+    }
+    lit_freq[256] = 1; // end of block
+    EnsureTwoSymbols(lit_freq, NumLitLenCodes);
+    EnsureTwoSymbols(dist_freq, NumDistCodes);
+
+    uint8_t lit_len[NumLitLenCodes], dist_len[NumDistCodes];
+    BuildCodeLengths(lit_freq, NumLitLenCodes, 15, lit_len, work);
+    BuildCodeLengths(dist_freq, NumDistCodes, 15, dist_len, work);
+
+    int hlit = NumLitLenCodes;
+    while (hlit > 257 && lit_len[hlit - 1] == 0) { --hlit; }
+    int hdist = NumDistCodes;
+    while (hdist > 1 && dist_len[hdist - 1] == 0) { --hdist; }
+
+    // code lengths of both tables, run-length encoded with codes 16 (repeat previous), 17 and 18 (repeat zero)
+    uint8_t all_len[NumLitLenCodes + NumDistCodes];
+    memcpy(all_len, lit_len, hlit);
+    memcpy(all_len + hlit, dist_len, hdist);
+    int num_len = hlit + hdist;
+    auto& cl_symbols = work.cl_symbols; // code, extra
+    cl_symbols.clear();
+    for (int i = 0; i < num_len;) {
+        int l = all_len[i];
+        int run = 1;
+        while (i + run < num_len && all_len[i + run] == l) { ++run; }
+        i += run;
+        if (l == 0) {
+            while (run >= 11) { int n = std::min(run, 138); cl_symbols.push_back({ 18, uint8_t(n - 11) }); run -= n; }
+            if (run >= 3) { cl_symbols.push_back({ 17, uint8_t(run - 3) }); run = 0; }
+        }
+        else {
+            cl_symbols.push_back({ uint8_t(l), 0 });
+            --run;
+            while (run >= 3) { int n = std::min(run, 6); cl_symbols.push_back({ 16, uint8_t(n - 3) }); run -= n; }
+        }
+        while (run-- > 0) { cl_symbols.push_back({ uint8_t(l), 0 }); }
+    }
+
+    uint32_t cl_freq[NumCodeLengthCodes] = {};
+    for (auto& s : cl_symbols) { ++cl_freq[s.first]; }
+    EnsureTwoSymbols(cl_freq, NumCodeLengthCodes);
+    uint8_t cl_len[NumCodeLengthCodes];
+    BuildCodeLengths(cl_freq, NumCodeLengthCodes, 7, cl_len, work);
+    int hclen = NumCodeLengthCodes;
+    while (hclen > 4 && cl_len[CodeLengthOrder[hclen - 1]] == 0) { --hclen; }
+
+    // compare with stored blocks
+    uint64_t bits = 3 + 14 + 3 * hclen;
+    for (auto& s : cl_symbols) { bits += cl_len[s.first] + CodeLengthExtra[s.first]; }
+    for (int i = 0; i < NumLitLenCodes; ++i) {
+        bits += (uint64_t)lit_freq[i] * (lit_len[i] + (i >= 257 ? LengthExtra[i - 257] : 0));
+    }
+    for (int i = 0; i < NumDistCodes; ++i) { bits += (uint64_t)dist_freq[i] * (dist_len[i] + DistExtra[i]); }
+    uint64_t stored_bits = ((uint64_t)raw_size + 5 * (raw_size / MaxStoredBlockSize + 1)) * 8;
+    if (stored_bits < bits) {
+        WriteStoredBlocks(bw, raw, raw_size, final);
+        return;
+    }
+
+    uint16_t lit_code[NumLitLenCodes], dist_code[NumDistCodes], cl_code[NumCodeLengthCodes];
+    BuildCodes(lit_len, NumLitLenCodes, lit_code);
+    BuildCodes(dist_len, NumDistCodes, dist_code);
+    BuildCodes(cl_len, NumCodeLengthCodes, cl_code);
+
+    bw.put(final ? 1 : 0, 1);
+    bw.put(2, 2); // dynamic huffman
+    bw.put(hlit - 257, 5);
+    bw.put(hdist - 1, 5);
+    bw.put(hclen - 4, 4);
+    for (int i = 0; i < hclen; ++i) { bw.put(cl_len[CodeLengthOrder[i]], 3); }
+    for (auto& s : cl_symbols) {
+        bw.put(cl_code[s.first], cl_len[s.first]);
+        if (CodeLengthExtra[s.first]) { bw.put(s.second, CodeLengthExtra[s.first]); }
+    }
+
+    for (auto& s : symbols) {
+        if (s.dist == 0) {
+            bw.put(lit_code[s.lit_or_len], lit_len[s.lit_or_len]);
+        }
+        else {
+            int lc = tables.len_code[s.lit_or_len];
+            bw.put(lit_code[257 + lc], lit_len[257 + lc]);
+            if (LengthExtra[lc]) { bw.put(s.lit_or_len - LengthBase[lc], LengthExtra[lc]); }
+            int dc = tables.getDistCode(s.dist);
+            bw.put(dist_code[dc], dist_len[dc]);
+            if (DistExtra[dc]) { bw.put(s.dist - DistBase[dc], DistExtra[dc]); }
+        }
+    }
+    bw.put(lit_code[256], lit_len[256]);
+}
+
+inline uint32_t Read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+} // namespace
+
+
+void fcPngFastDeflate(Buffer& dst, const uint8_t *src, size_t size, bool last, fcPngFastDeflateWork& work)
+{
+    BitWriter bw(dst, size / 2 + 1024);
+    auto& head = work.head;
+    head.assign(size_t(1) << HashBits, -1);
+    auto& symbols = work.symbols;
+    symbols.clear();
+    symbols.reserve(MaxSymbolsPerBlock);
+
+    size_t block_begin = 0;
+    size_t i = 0;
+    while (i < size) {
+        bool matched = false;
+        if (i + MinMatch <= size) {
+            uint32_t v = Read32(src + i);
+            uint32_t h = (v * 2654435761u) >> (32 - HashBits);
+            int32_t candidate = head[h];
+            head[h] = (int32_t)i;
+            if (candidate >= 0 && i - candidate <= WindowSize && Read32(src + candidate) == v) {
+                const uint8_t *a = src + candidate;
+                const uint8_t *b = src + i;
+                size_t max_len = std::min<size_t>(MaxMatch, size - i);
+                size_t len = MinMatch;
+                while (len + 8 <= max_len) {
+                    uint64_t x, y;
+                    memcpy(&x, a + len, 8);
+                    memcpy(&y, b + len, 8);
+                    if (x != y) { break; }
+                    len += 8;
+                }
+                while (len < max_len && a[len] == b[len]) { ++len; }
+
+                symbols.push_back({ uint16_t(len), uint16_t(i - candidate) });
+                i += len;
+                matched = true;
+            }
+        }
+        if (!matched) {
+            symbols.push_back({ src[i], 0 });
+            ++i;
+        }
+
+        if (symbols.size() >= MaxSymbolsPerBlock) {
+            WriteBlock(bw, src + block_begin, i - block_begin, false, work);
+            symbols.clear();
+            block_begin = i;
+        }
+    }
+    WriteBlock(bw, src + block_begin, size - block_begin, last, work);
+
+    if (!last) {
+        // empty stored block: byte aligned end, as Z_SYNC_FLUSH does
+        WriteStoredBlocks(bw, nullptr, 0, false);
+    }
+    bw.finish();
+}
@@ -0,0 +1,35 @@
+#ifndef fcPngDeflate_h
+#define fcPngDeflate_h
+
+// scratch memory of fcPngFastDeflate(). keep it across calls so that the hash table and the huffman builder are not
+// allocated each time.
+struct fcPngFastDeflateWork
+{
+    // literal (dist == 0) or match
+    struct Symbol
+    {
+        uint16_t lit_or_len;
+        uint16_t dist;
+    };
+    struct Node { uint32_t freq; int parent; };
+    typedef std::pair<uint32_t, int> Item; // freq, node
+
+    std::vector<int32_t> head; // hash -> last position
+    std::vector<Symbol> symbols; // of the current block
+
+    // huffman builder
+    std::vector<uint32_t> freq;
+    std::vector<Node> nodes;
+    std::vector<int> leaf_symbols;
+    std::vector<int> depth;
+    std::vector<Item> queue; // heap
+    std::vector<std::pair<uint8_t, uint8_t>> cl_symbols; // code, extra
+};
+
+// deflate of fcPngBackend_Fast. greedy LZ77 with a single-probe hash (as LZ4 / fpng do) and a dynamic huffman block
+// per 64K symbols. several times faster than zlib, at the cost of some size.
+// output is raw deflate (no zlib header / adler-32). unless last, it ends with an empty stored block (byte aligned,
+// not final), so that strips compressed independently can be concatenated into one stream.
+void fcPngFastDeflate(Buffer& dst, const uint8_t *src, size_t size, bool last, fcPngFastDeflateWork& work);
+
+#endif // fcPngDeflate_h
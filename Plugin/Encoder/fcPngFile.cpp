@@ -3,8 +3,10 @@
 #include "fcThreadPool.h"
 #include "GraphicsDevice/fcGraphicsDevice.h"
 #include "fcPngFile.h"
+#include "fcPngDeflate.h"
 
 #include <libpng/png.h>
+#include <zlib.h>
 #include <half.h>
 #ifdef fcWindows
     #pragma comment(lib, "libpng16_static.lib")
@@ -13,9 +15,310 @@
 #endif
 
 
+// blocks freed by libpng and zlib are kept, and given back for the same size later. an encoder asks for the same
+// sizes every frame (png_struct, deflate state, row buffers), so nothing is allocated after the first frame of a sequence.
+// not thread safe. each pool is used by one task at a time.
+class fcPngMemoryPool
+{
+public:
+    static const size_t MaxFreeBlocks = 64;
+
+    fcPngMemoryPool() {}
+    fcPngMemoryPool(const fcPngMemoryPool&) = delete;
+    fcPngMemoryPool(fcPngMemoryPool&& v) noexcept : m_free(std::move(v.m_free)) { v.m_free.clear(); }
+    ~fcPngMemoryPool()
+    {
+        for (auto& b : m_free) { ::free((Header*)b.ptr - 1); }
+    }
+
+    void* allocate(size_t size)
+    {
+        for (size_t i = 0; i < m_free.size(); ++i) {
+            if (m_free[i].size == size) {
+                void *ret = m_free[i].ptr;
+                m_free[i] = m_free.back();
+                m_free.pop_back();
+                return ret;
+            }
+        }
+        Header *h = (Header*)::malloc(sizeof(Header) + size);
+        if (h == nullptr) { return nullptr; }
+        h->size = size;
+        return h + 1;
+    }
+
+    void deallocate(void *p)
+    {
+        if (p == nullptr) { return; }
+        Header *h = (Header*)p - 1;
+        if (m_free.size() >= MaxFreeBlocks) {
+            ::free(h);
+            return;
+        }
+        m_free.push_back({ h->size, p });
+    }
+
+    // hooks for png_create_write_struct_2() (mem_ptr is the pool) and z_stream (opaque is the pool)
+    static png_voidp pngAlloc(png_structp png_ptr, png_alloc_size_t size)
+    {
+        return ((fcPngMemoryPool*)::png_get_mem_ptr(png_ptr))->allocate(size);
+    }
+    static void pngFree(png_structp png_ptr, png_voidp p)
+    {
+        ((fcPngMemoryPool*)::png_get_mem_ptr(png_ptr))->deallocate(p);
+    }
+    static voidpf zAlloc(voidpf opaque, uInt items, uInt size)
+    {
+        return ((fcPngMemoryPool*)opaque)->allocate((size_t)items * size);
+    }
+    static void zFree(voidpf opaque, voidpf p)
+    {
+        ((fcPngMemoryPool*)opaque)->deallocate(p);
+    }
+
+private:
+    struct Header { size_t size; size_t padding; }; // 16 bytes to keep the alignment of malloc()
+    struct Block { size_t size; void *ptr; };
+    std::vector<Block> m_free;
+};
+
+// parallel encoding (fcPngConfig::parallel_encoding) and fcPngBackend_Fast.
+// rows are split into strips. each strip is filtered and deflated on its own task and ends at a byte boundary (full flush),
+// so the strips can be stitched into one zlib stream. the adler-32 of the whole stream is combined from the strips'.
+// without parallel_encoding, the whole image is one strip.
+#define fcPngStripMinBytes  (256 * 1024) // smaller strips are not worth a task
+#define fcPngWindowSize     32768
+#define fcPngMaxIdleTaskData 2 // task data kept while no export is running. each holds a frame and encoder buffers
+
+namespace {
+
+void fcPngWriteData(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    auto *os = (BinaryStream*)::png_get_io_ptr(png_ptr);
+    os->write(data, length);
+}
+
+void fcPngFlushData(png_structp /*png_ptr*/)
+{
+    // the destination is flushed when the png is done
+}
+
+struct fcPngStrip
+{
+    size_t begin, end; // rows
+    Buffer compressed;
+    uLong adler;
+    Buffer work; // for fcPngFilterRow()
+    fcPngMemoryPool mem; // deflate state
+    fcPngFastDeflateWork fast_work; // fcPngBackend_Fast deflate state
+};
+
+// buffers of fcPngWriteImageStrips(), kept across frames
+struct fcPngStripBuffers
+{
+    Buffer filtered;
+    std::vector<fcPngStrip> strips;
+};
+
+inline int fcPngPaeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a);
+    int pb = std::abs(p - b);
+    int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) { return a; }
+    if (pb <= pc) { return b; }
+    return c;
+}
+
+// dst[0] is filter type and dst[1..size] filtered row. prev is null for the first row.
+// filters: fcPngFilter bits (bit n = png filter type n). if more than one, pick the filter with the minimum sum of
+// absolute values, as libpng's heuristic does. work: size * 5 bytes
+void fcPngFilterRow(uint8_t *dst, const uint8_t *row, const uint8_t *prev, size_t size, int bpp, int filters, uint8_t *work)
+{
+    uint8_t *none = work, *sub = work + size, *up = work + size * 2, *avg = work + size * 3, *paeth = work + size * 4;
+    size_t n = std::min<size_t>(bpp, size);
+    if (filters & fcPngFilter_None) {
+        memcpy(none, row, size);
+    }
+    if (filters & fcPngFilter_Sub) {
+        for (size_t i = 0; i < n; ++i) { sub[i] = row[i]; }
+        for (size_t i = n; i < size; ++i) { sub[i] = uint8_t(row[i] - row[i - bpp]); }
+    }
+    if (filters & fcPngFilter_Up) {
+        if (prev) { for (size_t i = 0; i < size; ++i) { up[i] = uint8_t(row[i] - prev[i]); } }
+        else { memcpy(up, row, size); }
+    }
+    if (filters & fcPngFilter_Average) {
+        if (prev) {
+            for (size_t i = 0; i < n; ++i) { avg[i] = uint8_t(row[i] - (prev[i] >> 1)); }
+            for (size_t i = n; i < size; ++i) { avg[i] = uint8_t(row[i] - ((row[i - bpp] + prev[i]) >> 1)); }
+        }
+        else {
+            for (size_t i = 0; i < n; ++i) { avg[i] = row[i]; }
+            for (size_t i = n; i < size; ++i) { avg[i] = uint8_t(row[i] - (row[i - bpp] >> 1)); }
+        }
+    }
+    if (filters & fcPngFilter_Paeth) {
+        if (prev) {
+            for (size_t i = 0; i < n; ++i) { paeth[i] = uint8_t(row[i] - prev[i]); }
+            for (size_t i = n; i < size; ++i) { paeth[i] = uint8_t(row[i] - fcPngPaeth(row[i - bpp], prev[i], prev[i - bpp])); }
+        }
+        else {
+            // same as sub
+            for (size_t i = 0; i < n; ++i) { paeth[i] = row[i]; }
+            for (size_t i = n; i < size; ++i) { paeth[i] = uint8_t(row[i] - row[i - bpp]); }
+        }
+    }
+
+    int best = 0;
+    uint64_t best_sum = ~0ull;
+    for (int f = 0; f < 5; ++f) {
+        if ((filters & (1 << f)) == 0) { continue; }
+        if (filters == (1 << f)) {
+            best = f; // only one
+            break;
+        }
+        const uint8_t *out = work + size * f;
+        uint64_t sum = 0;
+        for (size_t i = 0; i < size; ++i) { sum += std::abs((int)(int8_t)out[i]); }
+        if (sum < best_sum) {
+            best_sum = sum;
+            best = f;
+        }
+    }
+    dst[0] = uint8_t(best);
+    memcpy(dst + 1, work + size * best, size);
+}
+
+// raw deflate src. the output ends with a full flush (byte aligned, not final) unless last.
+// dict: preceding data, so that matches across strips are found as single stream compression does.
+bool fcPngDeflateStrip(Buffer& dst, const uint8_t *src, size_t size, const uint8_t *dict, size_t dict_size, bool last,
+    int level, int strategy, fcPngMemoryPool& mem)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    zs.zalloc = fcPngMemoryPool::zAlloc;
+    zs.zfree = fcPngMemoryPool::zFree;
+    zs.opaque = &mem;
+    if (::deflateInit2(&zs, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) { return false; }
+    if (dict_size > 0) { ::deflateSetDictionary(&zs, dict, (uInt)dict_size); }
+
+    dst.resize(::deflateBound(&zs, (uLong)size) + 64);
+    zs.next_in = (Bytef*)src;
+    zs.avail_in = (uInt)size;
+    int flush = last ? Z_FINISH : Z_FULL_FLUSH;
+    bool ok = true;
+    for (;;) {
+        zs.next_out = (Bytef*)&dst[zs.total_out];
+        zs.avail_out = (uInt)(dst.size() - zs.total_out);
+        int ret = ::deflate(&zs, flush);
+        if (ret == Z_STREAM_ERROR) { ok = false; break; }
+        if (last ? ret == Z_STREAM_END : (zs.avail_in == 0 && zs.avail_out != 0)) { break; }
+        dst.resize(dst.size() * 2);
+    }
+    dst.resize(zs.total_out);
+    ::deflateEnd(&zs);
+    return ok;
+}
+
+// write IDAT chunks of rows. bpp: bytes per pixel
+bool fcPngWriteImageStrips(png_structp png_ptr, png_bytep *rows, int height, size_t pitch, int bpp, const fcPngConfig& conf,
+    fcPngStripBuffers& buffers)
+{
+    // strips: at least fcPngStripMinBytes each, and about twice as many as workers to balance the load
+    size_t strip_rows = height;
+    if (conf.parallel_encoding) {
+        size_t num_workers = std::max<size_t>(fcGetNumWorkerThreads(), 1);
+        strip_rows = std::max<size_t>((height + num_workers * 2 - 1) / (num_workers * 2), (fcPngStripMinBytes + pitch - 1) / pitch);
+    }
+    size_t num_strips = (height + strip_rows - 1) / strip_rows;
+
+    auto& strips = buffers.strips;
+    strips.resize(num_strips);
+    for (size_t si = 0; si < num_strips; ++si) {
+        strips[si].begin = strip_rows * si;
+        strips[si].end = std::min<size_t>(strip_rows * (si + 1), height);
+    }
+
+    // filtered rows of the whole image. the tail of a strip is the dictionary of the next one
+    size_t filtered_pitch = pitch + 1;
+    Buffer& filtered = buffers.filtered;
+    filtered.resize(filtered_pitch * height);
+    std::atomic_bool ok(true);
+    fcParallelFor(num_strips, 1, [&](size_t sbegin, size_t send) {
+        for (size_t si = sbegin; si < send; ++si) {
+            Buffer& work = strips[si].work;
+            work.resize(pitch * 5);
+            for (size_t y = strips[si].begin; y < strips[si].end; ++y) {
+                fcPngFilterRow((uint8_t*)&filtered[filtered_pitch * y], rows[y], y > 0 ? rows[y - 1] : nullptr, pitch, bpp,
+                    conf.filters, (uint8_t*)&work[0]);
+            }
+        }
+    }, conf.task_priority);
+    fcParallelFor(num_strips, 1, [&](size_t sbegin, size_t send) {
+        for (size_t si = sbegin; si < send; ++si) {
+            auto& strip = strips[si];
+            const uint8_t *src = (const uint8_t*)&filtered[filtered_pitch * strip.begin];
+            size_t size = filtered_pitch * (strip.end - strip.begin);
+            bool last = si == num_strips - 1;
+            if (conf.backend == fcPngBackend_Fast) {
+                // no dictionary. matches across strips are lost, but it is only a few rows per strip
+                fcPngFastDeflate(strip.compressed, src, size, last, strip.fast_work);
+            }
+            else {
+                size_t dict_size = std::min<size_t>(filtered_pitch * strip.begin, fcPngWindowSize);
+                if (!fcPngDeflateStrip(strip.compressed, src, size, src - dict_size, dict_size, last,
+                    conf.compression_level, conf.compression_strategy, strip.mem))
+                {
+                    ok = false;
+                }
+            }
+            strip.adler = ::adler32(::adler32(0, nullptr, 0), src, (uInt)size);
+        }
+    }, conf.task_priority);
+    if (!ok) {
+        fcDebugLog("fcPngWriteImageStrips(): deflate failed");
+        return false;
+    }
+
+    // zlib header: deflate with 32K window, and compression level hint
+    uint8_t header[2] = { 0x78, 0 };
+    int level = conf.backend == fcPngBackend_Fast ? 1 : conf.compression_level;
+    int flevel = level <= 1 ? 0 : level <= 5 ? 1 : level == 6 ? 2 : 3;
+    header[1] = uint8_t(flevel << 6);
+    header[1] += uint8_t(31 - (header[0] * 256 + header[1]) % 31);
+
+    uLong adler = strips[0].adler;
+    for (size_t si = 1; si < num_strips; ++si) {
+        adler = ::adler32_combine(adler, strips[si].adler, (z_off_t)(filtered_pitch * (strips[si].end - strips[si].begin)));
+    }
+    uint8_t trailer[4] = { uint8_t(adler >> 24), uint8_t(adler >> 16), uint8_t(adler >> 8), uint8_t(adler) };
+
+    // one IDAT chunk per strip
+    for (size_t si = 0; si < num_strips; ++si) {
+        auto& strip = strips[si];
+        bool first = si == 0;
+        bool last = si == num_strips - 1;
+        size_t size = strip.compressed.size() + (first ? sizeof(header) : 0) + (last ? sizeof(trailer) : 0);
+        ::png_write_chunk_start(png_ptr, (png_const_bytep)"IDAT", (png_uint_32)size);
+        if (first) { ::png_write_chunk_data(png_ptr, header, sizeof(header)); }
+        ::png_write_chunk_data(png_ptr, (png_const_bytep)strip.compressed.ptr(), strip.compressed.size());
+        if (last) { ::png_write_chunk_data(png_ptr, trailer, sizeof(trailer)); }
+        ::png_write_chunk_end(png_ptr);
+    }
+    return true;
+}
+
+} // namespace
+
+
 struct fcPngTaskData
 {
     std::string path;
+    fcStream *stream;
+    fcPngDataCallback_t data_cb;
+    void *data_userdata;
     Buffer pixels;
     Buffer buf; // buffer for conversion
     int width;
@@ -23,41 +326,91 @@ struct fcPngTaskData
     fcPixelFormat format;
     bool flipY;
 
-    fcPngTaskData() : width(), height(), format(), flipY() {}
+    // encoder state. task data are recycled (see fcPngContext::newTaskData()), so these are reused across frames
+    std::vector<png_bytep> rows;
+    Buffer encoded; // png for streams and callbacks
+    fcPngStripBuffers strip_buffers;
+    fcPngMemoryPool mem; // libpng and its deflate state
+
+    fcPngTaskData() : stream(), data_cb(), data_userdata(), width(), height(), format(), flipY() {}
+
+    void setOutput(const fcPngOutput& out)
+    {
+        path = out.path ? out.path : "";
+        stream = out.stream;
+        data_cb = out.data_cb;
+        data_userdata = out.data_userdata;
+    }
 };
 
+
 class fcPngContext : public fcIPngContext
 {
 public:
     fcPngContext(const fcPngConfig& conf, fcIGraphicsDevice *dev);
     ~fcPngContext() override;
     void release() override;
-    bool exportTexture(const char *path, void *tex, int width, int height, fcPixelFormat fmt, bool flipY) override;
-    bool exportPixels(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY) override;
+    bool exportTexture(const fcPngOutput& out, void *tex, int width, int height, fcPixelFormat fmt, bool flipY) override;
+    bool exportPixels(const fcPngOutput& out, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY, fcJob *job) override;
+    int getActiveTaskCount() override;
 
 private:
-    void waitSome();
+    static bool hasDestination(const fcPngOutput& out);
+    bool acquireSlot();
+    fcPngTaskData* newTaskData();
+    void recycleTaskData(fcPngTaskData *data);
+    void kickTask(fcPngTaskData *data, fcJob *job = nullptr);
     bool exportPixelsBody(fcPngTaskData& data);
 
 private:
     fcPngConfig m_conf;
     fcIGraphicsDevice *m_dev;
     fcTaskGroup m_tasks;
-    std::atomic_int m_active_task_count;
+    std::unique_ptr<fcSemaphore> m_slots;
+    std::mutex m_stream_mutex; // serializes writes of exports to streams
+    std::mutex m_data_mutex;
+    std::vector<fcPngTaskData*> m_free_data; // finished task data. at most max_active_tasks, fcPngMaxIdleTaskData when idle
 };
 
 fcPngContext::fcPngContext(const fcPngConfig& conf, fcIGraphicsDevice *dev)
-    : m_conf(), m_dev(dev), m_active_task_count()
+    : m_conf(), m_dev(dev)
 {
     m_conf = conf;
     if (m_conf.max_active_tasks <= 0) {
         m_conf.max_active_tasks = std::thread::hardware_concurrency();
     }
+    m_slots.reset(new fcSemaphore(m_conf.max_active_tasks));
+
+    // fill the parameters left to the preset
+    struct Preset { int level; fcPngStrategy strategy; int filters; };
+    static const Preset presets[] = {
+        { 6, fcPngStrategy_Filtered, fcPngFilter_All }, // Balanced
+        { 1, fcPngStrategy_RLE, fcPngFilter_Sub },      // Fastest
+        { 9, fcPngStrategy_Filtered, fcPngFilter_All }, // Smallest
+    };
+    if (m_conf.preset < fcPngPreset_Balanced || m_conf.preset > fcPngPreset_Smallest) {
+        m_conf.preset = fcPngPreset_Balanced;
+    }
+    const Preset& preset = presets[m_conf.preset];
+    if (m_conf.compression_level < 0 || m_conf.compression_level > 9) {
+        m_conf.compression_level = preset.level;
+    }
+    if (m_conf.compression_strategy < fcPngStrategy_Default || m_conf.compression_strategy > fcPngStrategy_Fixed) {
+        m_conf.compression_strategy = preset.strategy;
+    }
+    m_conf.filters &= fcPngFilter_All;
+    if (m_conf.filters == fcPngFilter_Preset) {
+        m_conf.filters = preset.filters;
+    }
+    if (m_conf.backend != fcPngBackend_Zlib && m_conf.backend != fcPngBackend_Fast) {
+        m_conf.backend = fcPngBackend_Zlib;
+    }
 }
 
 fcPngContext::~fcPngContext()
 {
     m_tasks.wait();
+    for (auto *data : m_free_data) { delete data; }
 }
 
 void fcPngContext::release()
@@ -65,16 +418,20 @@ void fcPngContext::release()
     delete this;
 }
 
-bool fcPngContext::exportTexture(const char *path_, void *tex, int width, int height, fcPixelFormat fmt, bool flipY)
+bool fcPngContext::exportTexture(const fcPngOutput& out, void *tex, int width, int height, fcPixelFormat fmt, bool flipY)
 {
     if (m_dev == nullptr) {
         fcDebugLog("fcPngContext::exportTexture(): gfx device is null.");
         return false;
     }
-    waitSome();
+    if (!hasDestination(out)) {
+        fcDebugLog("fcPngContext::exportTexture(): no destination.");
+        return false;
+    }
+    if (!acquireSlot()) { return false; }
 
-    auto data = new fcPngTaskData();
-    data->path = path_;
+    auto data = newTaskData();
+    data->setOutput(out);
     data->width = width;
     data->height = height;
     data->format = fmt;
@@ -83,51 +440,104 @@ bool fcPngContext::exportTexture(const char *path_, void *tex, int width, int he
     // get surface data
     data->pixels.resize(width * height * fcGetPixelSize(fmt));
     if (!m_dev->readTexture(&data->pixels[0], data->pixels.size(), tex, width, height, fmt)) {
-        delete data;
+        recycleTaskData(data);
+        m_slots->release();
         return false;
     }
 
-    // kick export task
-    ++m_active_task_count;
-    m_tasks.run([this, data]() {
-        exportPixelsBody(*data);
-        delete data;
-        --m_active_task_count;
-    });
-
-    return false;
+    kickTask(data);
+    return true;
 }
 
-bool fcPngContext::exportPixels(const char *path_, const void *pixels_, int width, int height, fcPixelFormat fmt, bool flipY)
+bool fcPngContext::exportPixels(const fcPngOutput& out, const void *pixels_, int width, int height, fcPixelFormat fmt, bool flipY, fcJob *job)
 {
-    waitSome();
+    if (!hasDestination(out)) {
+        fcDebugLog("fcPngContext::exportPixels(): no destination.");
+        return false;
+    }
+    if (!acquireSlot()) { return false; }
 
-    auto data = new fcPngTaskData();
-    data->path = path_;
+    auto data = newTaskData();
+    data->setOutput(out);
     data->width = width;
     data->height = height;
     data->format = fmt;
     data->flipY = flipY;
     data->pixels.assign((char*)pixels_, width * height * fcGetPixelSize(fmt));
 
-    // kick export task
-    ++m_active_task_count;
-    m_tasks.run([this, data]() {
-        exportPixelsBody(*data);
-        delete data;
-        --m_active_task_count;
-    });
+    kickTask(data, job);
     return true;
 }
 
-void fcPngContext::waitSome()
+int fcPngContext::getActiveTaskCount()
+{
+    return m_conf.max_active_tasks - m_slots->getCount();
+}
+
+// a path, a stream or a callback
+bool fcPngContext::hasDestination(const fcPngOutput& out)
+{
+    return (out.path && out.path[0] != '\0') || out.stream || out.data_cb;
+}
+
+bool fcPngContext::acquireSlot()
+{
+    // wait for just one slot to be freed, not for all running tasks
+    if (m_conf.non_blocking) {
+        if (!m_slots->tryAcquire()) {
+            fcDebugLog("fcPngContext::acquireSlot(): all slots are in use.");
+            return false;
+        }
+    }
+    else {
+        m_slots->acquire();
+    }
+    return true;
+}
+
+fcPngTaskData* fcPngContext::newTaskData()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_data_mutex);
+        if (!m_free_data.empty()) {
+            auto *ret = m_free_data.back();
+            m_free_data.pop_back();
+            return ret;
+        }
+    }
+    return new fcPngTaskData();
+}
+
+void fcPngContext::recycleTaskData(fcPngTaskData *data)
 {
-    if (m_active_task_count >= m_conf.max_active_tasks) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        if (m_active_task_count >= m_conf.max_active_tasks) {
-            m_tasks.wait();
+    std::vector<fcPngTaskData*> trimmed;
+    {
+        std::unique_lock<std::mutex> lock(m_data_mutex);
+        m_free_data.push_back(data);
+        // the calling task is the last one running: capture has paused or ended. release memory of the others,
+        // keeping the most recently used ones
+        if (getActiveTaskCount() <= 1 && m_free_data.size() > fcPngMaxIdleTaskData) {
+            auto end = m_free_data.end() - fcPngMaxIdleTaskData;
+            trimmed.assign(m_free_data.begin(), end);
+            m_free_data.erase(m_free_data.begin(), end);
         }
     }
+    for (auto *d : trimmed) { delete d; }
+}
+
+void fcPngContext::kickTask(fcPngTaskData *data, fcJob *job)
+{
+    // the slot taken by acquireSlot() is released when the task is done
+    if (job) { job->addRef(); }
+    m_tasks.run([this, data, job]() {
+        bool succeeded = exportPixelsBody(*data);
+        recycleTaskData(data);
+        m_slots->release();
+        if (job) {
+            job->complete(succeeded);
+            job->release();
+        }
+    }, m_conf.task_priority);
 }
 
 bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
@@ -138,10 +548,7 @@ bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
     int bit_depth = 0;
     int num_channels = 0;
     int color_type = 0;
-
-    if (data.flipY) {
-        fcImageFlipY(&data.pixels[0], data.width, data.height, data.format);
-    }
+    fcPixelFormat conv_fmt = data.format; // format to be written
 
     switch (data.format) {
         // u8
@@ -156,9 +563,7 @@ bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
         color_type = PNG_COLOR_TYPE_RGB;
         break;
     case fcPixelFormat_RGu8:
-        data.buf.resize(npixels * 3);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBu8, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBu8;
         bit_depth = 8;
         num_channels = 3;
         color_type = PNG_COLOR_TYPE_RGB;
@@ -171,33 +576,25 @@ bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
 
         // f16 -> i16
     case fcPixelFormat_RGBAf16:
-        data.buf.resize(npixels * 8);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBAi16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBAi16;
         bit_depth = 16;
         num_channels = 4;
         color_type = PNG_COLOR_TYPE_RGB_ALPHA;
         break;
     case fcPixelFormat_RGBf16:
-        data.buf.resize(npixels * 6);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBi16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBi16;
         bit_depth = 16;
         num_channels = 3;
         color_type = PNG_COLOR_TYPE_RGB;
         break;
     case fcPixelFormat_RGf16:
-        data.buf.resize(npixels * 6);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBi16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBi16;
         bit_depth = 16;
         num_channels = 3;
         color_type = PNG_COLOR_TYPE_RGB;
         break;
     case fcPixelFormat_Rf16:
-        data.buf.resize(npixels * 2);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_Ri16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_Ri16;
         bit_depth = 16;
         num_channels = 1;
         color_type = PNG_COLOR_TYPE_GRAY;
@@ -205,33 +602,25 @@ bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
 
         // f32 -> i16 (png doesn't support 32bit color :( )
     case fcPixelFormat_RGBAf32:
-        data.buf.resize(npixels * 8);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBAi16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBAi16;
         bit_depth = 16;
         num_channels = 4;
         color_type = PNG_COLOR_TYPE_RGB_ALPHA;
         break;
     case fcPixelFormat_RGBf32:
-        data.buf.resize(npixels * 6);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBi16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBi16;
         bit_depth = 16;
         num_channels = 3;
         color_type = PNG_COLOR_TYPE_RGB;
         break;
     case fcPixelFormat_RGf32:
-        data.buf.resize(npixels * 6);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_RGBi16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_RGBi16;
         bit_depth = 16;
         num_channels = 3;
         color_type = PNG_COLOR_TYPE_RGB;
         break;
     case fcPixelFormat_Rf32:
-        data.buf.resize(npixels * 2);
-        fcConvertPixelFormat(&data.buf[0], fcPixelFormat_Ri16, &data.pixels[0], data.format, npixels);
-        pixels = (png_bytep)&data.buf[0];
+        conv_fmt = fcPixelFormat_Ri16;
         bit_depth = 16;
         num_channels = 1;
         color_type = PNG_COLOR_TYPE_GRAY;
@@ -242,9 +631,25 @@ bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
         return false;
     }
 
-    png_structp png_ptr = ::png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+    // convert and flip in one pass. if no conversion is needed, flip by reversing the order of rows.
+    bool flip_rows = data.flipY;
+    if (conv_fmt != data.format) {
+        data.buf.resize(npixels * fcGetPixelSize(conv_fmt));
+        if (m_conf.parallel_encoding) {
+            fcConvertPixelFormatImageParallel(&data.buf[0], conv_fmt, 0, &data.pixels[0], data.format, 0, data.width, data.height, data.flipY);
+        }
+        else {
+            fcConvertPixelFormatImage(&data.buf[0], conv_fmt, 0, &data.pixels[0], data.format, 0, data.width, data.height, data.flipY);
+        }
+        pixels = (png_bytep)&data.buf[0];
+        flip_rows = false;
+    }
+
+    // libpng has no way to reset a write struct for the next image. it is created for each frame, but from pooled memory
+    png_structp png_ptr = ::png_create_write_struct_2(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr,
+        &data.mem, fcPngMemoryPool::pngAlloc, fcPngMemoryPool::pngFree);
     if (png_ptr == nullptr) {
-        fcDebugLog("fcPngContext::exportPixelsBody(): png_create_write_struct() returned nullptr");
+        fcDebugLog("fcPngContext::exportPixelsBody(): png_create_write_struct_2() returned nullptr");
         return false;
     }
 
@@ -255,30 +660,74 @@ bool fcPngContext::exportPixelsBody(fcPngTaskData& data)
         return false;
     }
 
-    FILE *ofile = ::fopen(data.path.c_str(), "wb");
-    if (ofile == nullptr) {
-        fcDebugLog("fcPngContext::exportPixelsBody(): file open failed");
-        ::png_destroy_write_struct(&png_ptr, &info_ptr);
-        return false;
+    // files are written as encoded. for streams and callbacks the png is encoded in memory and passed as a whole,
+    // so that exports running in parallel don't interleave their data
+    std::unique_ptr<FileStream> ofile;
+    Buffer& encoded = data.encoded;
+    encoded.clear();
+    BufferStream memory(encoded);
+    BinaryStream *os = &memory;
+    if (!data.path.empty()) {
+        ofile.reset(new FileStream(data.path.c_str()));
+        if (!ofile->isOpened()) {
+            fcDebugLog("fcPngContext::exportPixelsBody(): file open failed");
+            ::png_destroy_write_struct(&png_ptr, &info_ptr);
+            return false;
+        }
+        os = ofile.get();
     }
 
-    ::png_init_io(png_ptr, ofile);
+    ::png_set_write_fn(png_ptr, os, fcPngWriteData, fcPngFlushData);
     ::png_set_IHDR(png_ptr, info_ptr, data.width, data.height, bit_depth, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    ::png_set_compression_level(png_ptr, m_conf.compression_level);
+    ::png_set_compression_strategy(png_ptr, m_conf.compression_strategy);
+    ::png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, m_conf.filters << 3); // fcPngFilter_None -> PNG_FILTER_NONE (0x08), ...
     ::png_write_info(png_ptr, info_ptr);
 
     int pitch = data.width * (bit_depth / 8) * num_channels;
-    std::vector<png_bytep> row_pointers(data.height);
+    auto& row_pointers = data.rows;
+    row_pointers.resize(data.height);
     for (int yi = 0; yi <data.height; ++yi) {
-        row_pointers[yi] = &pixels[pitch * yi];
+        row_pointers[yi] = &pixels[pitch * (flip_rows ? data.height - 1 - yi : yi)];
     }
 
-    ::png_write_image(png_ptr, &row_pointers[0]);
-    ::png_write_end(png_ptr, info_ptr);
+    bool ret = true;
+    if (m_conf.parallel_encoding || m_conf.backend == fcPngBackend_Fast) {
+        // IDAT chunks are written by hand. png_write_end() requires rows written by libpng, so IEND is too.
+        ret = fcPngWriteImageStrips(png_ptr, &row_pointers[0], data.height, pitch, (bit_depth / 8) * num_channels, m_conf,
+            data.strip_buffers);
+        ::png_write_chunk(png_ptr, (png_const_bytep)"IEND", nullptr, 0);
+    }
+    else {
+        ::png_write_image(png_ptr, &row_pointers[0]);
+        ::png_write_end(png_ptr, info_ptr);
+    }
 
-    ::fclose(ofile);
     ::png_destroy_write_struct(&png_ptr, &info_ptr);
+    if (ofile) {
+        ofile->flush();
+        if (ofile->failed()) {
+            fcDebugLog("fcPngContext::exportPixelsBody(): file write failed");
+            ret = false;
+        }
+        ofile.reset();
+    }
 
-    return true;
+    if (ret && data.stream) {
+        std::unique_lock<std::mutex> lock(m_stream_mutex);
+        // flush so that buffered streams (custom streams) pass the image to the host before the job completes
+        bool written = data.stream->write(encoded.ptr(), encoded.size()) == encoded.size();
+        data.stream->flush();
+        if (!written || data.stream->failed()) {
+            fcDebugLog("fcPngContext::exportPixelsBody(): stream write failed");
+            ret = false;
+        }
+    }
+    if (ret && data.data_cb) {
+        data.data_cb(encoded.ptr(), encoded.size(), data.data_userdata);
+    }
+
+    return ret;
 }
 
 fcCLinkage fcExport fcIPngContext* fcPngCreateContextImpl(const fcPngConfig *conf, fcIGraphicsDevice *dev)
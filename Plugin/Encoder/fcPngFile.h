@@ -1,12 +1,25 @@
 #ifndef fcPNGFile_h
 #define fcPNGFile_h
 
+// destination of an export. one of path, stream or data_cb
+struct fcPngOutput
+{
+    const char *path;
+    fcStream *stream;
+    fcPngDataCallback_t data_cb;
+    void *data_userdata;
+
+    fcPngOutput(const char *p = nullptr) : path(p), stream(), data_cb(), data_userdata() {}
+};
+
 class fcIPngContext
 {
 public:
     virtual void release() = 0;
-    virtual bool exportTexture(const char *path, void *tex, int width, int height, fcPixelFormat fmt, bool flipY) = 0;
-    virtual bool exportPixels(const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY) = 0;
+    virtual bool exportTexture(const fcPngOutput& out, void *tex, int width, int height, fcPixelFormat fmt, bool flipY) = 0;
+    // job (optional) is completed when the png is written
+    virtual bool exportPixels(const fcPngOutput& out, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY, fcJob *job = nullptr) = 0;
+    virtual int getActiveTaskCount() = 0;
 protected:
     virtual ~fcIPngContext() {}
 };
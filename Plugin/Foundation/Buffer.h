@@ -43,6 +43,7 @@ typedef TDataRef<char> DataRef;
 
 
 // low-level vector<>. T must be POD type
+// like std::vector, capacity grows geometrically and clear() / shrinking resize() keep the allocated memory.
 template<class T>
 class TBuffer
 {
@@ -53,18 +54,39 @@ public:
     typedef T*          pointer;
     typedef const T*    const_pointer;
 
-    TBuffer() : m_data(), m_size() {}
-    explicit TBuffer(size_t size) : m_data(), m_size() { resize(size); }
-    TBuffer(const void *src, size_t len) : m_data(), m_size() { assign(src, len); }
-    TBuffer(TBuffer& v) : m_data(), m_size() { assign(v.ptr(), v.size()); }
-    TBuffer(TBuffer&& v) : m_data(v.ptr()), m_size(v.size()) {}
-    TBuffer& operator=(TBuffer& v) { assign(v.ptr(), v.size()); return *this; }
-    ~TBuffer() { clear(); }
+    TBuffer() : m_data(), m_size(), m_capacity() {}
+    explicit TBuffer(size_t size) : m_data(), m_size(), m_capacity() { resize(size); }
+    TBuffer(const void *src, size_t len) : m_data(), m_size(), m_capacity() { assign(src, len); }
+    TBuffer(const TBuffer& v) : m_data(), m_size(), m_capacity() { assign(v.ptr(), v.size()); }
+    TBuffer(TBuffer&& v) noexcept : m_data(v.m_data), m_size(v.m_size), m_capacity(v.m_capacity)
+    {
+        v.m_data = nullptr;
+        v.m_size = v.m_capacity = 0;
+    }
+    TBuffer& operator=(const TBuffer& v)
+    {
+        if (this != &v) { assign(v.ptr(), v.size()); }
+        return *this;
+    }
+    TBuffer& operator=(TBuffer&& v) noexcept
+    {
+        if (this != &v) {
+            AlignedFree(m_data);
+            m_data = v.m_data;
+            m_size = v.m_size;
+            m_capacity = v.m_capacity;
+            v.m_data = nullptr;
+            v.m_size = v.m_capacity = 0;
+        }
+        return *this;
+    }
+    ~TBuffer() { AlignedFree(m_data); }
 
     value_type&         operator[](size_t i) { return m_data[i]; }
     const value_type&   operator[](size_t i) const { return m_data[i]; }
 
     size_t          size() const    { return m_size; }
+    size_t          capacity() const{ return m_capacity; }
     bool            empty() const   { return m_size == 0; }
     iterator        begin()         { return m_data; }
     const_iterator  begin() const   { return m_data; }
@@ -88,28 +110,53 @@ public:
         memcpy(ptr() + pos, src, sizeof(T) * len);
     }
 
+    // reallocates only when newsize exceeds capacity. the capacity is at least doubled then,
+    // so growing by append() / write() is amortized O(1) per element.
     void resize(size_t newsize)
     {
-        T *new_data = (T*)AlignedAlloc(sizeof(T) * newsize, 0x20);
-        if (m_data) {
-            memcpy(new_data, m_data, std::min<size_t>(sizeof(T) * m_size, sizeof(T) * newsize));
+        if (newsize > m_capacity) {
+            reallocate(std::max<size_t>(newsize, m_capacity * 2));
         }
-
-        clear();
-        m_data = new_data;
         m_size = newsize;
     }
 
+    // allocate exactly newcapacity if it is larger than the current capacity. size is not changed.
+    void reserve(size_t newcapacity)
+    {
+        if (newcapacity > m_capacity) {
+            reallocate(newcapacity);
+        }
+    }
+
+    // release the memory beyond size()
+    void shrink_to_fit()
+    {
+        if (m_capacity > m_size) {
+            reallocate(m_size);
+        }
+    }
+
+    // size becomes 0 but the memory is kept. call shrink_to_fit() after this to release it.
     void clear()
     {
-        AlignedFree(m_data);
-        m_data = nullptr;
         m_size = 0;
     }
 
 protected:
+    void reallocate(size_t newcapacity)
+    {
+        T *new_data = newcapacity > 0 ? (T*)AlignedAlloc(sizeof(T) * newcapacity, 0x20) : nullptr;
+        if (m_data) {
+            memcpy(new_data, m_data, sizeof(T) * std::min<size_t>(m_size, newcapacity));
+            AlignedFree(m_data);
+        }
+        m_data = new_data;
+        m_capacity = newcapacity;
+    }
+
     T *m_data;
     size_t m_size;
+    size_t m_capacity;
 };
 typedef TBuffer<char> Buffer;
 
@@ -125,6 +172,11 @@ public:
     virtual size_t  tellp() = 0;
     virtual void    seekp(size_t pos) = 0;
     virtual size_t  write(const void *data, size_t len) = 0;
+    // pass buffered data to the underlying device. streams that have no buffer do nothing.
+    virtual void    flush() {}
+    // true if any data could not be written to the underlying device. once set, it stays set.
+    // buffered data is written later, so check this after flush() to know that everything is written.
+    virtual bool    failed() const { return false; }
 };
 
 inline BinaryStream& operator<<(BinaryStream &o, const int8_t&   v) { o.write(&v, 1); return o; }
@@ -209,6 +261,96 @@ protected:
 };
 
 
+// memory stream made of fixed-size segments. unlike BufferStream, growing never reallocates or copies
+// already written data, so a long recording needs no contiguous block and no 2x peak memory.
+class SegmentedBufferStream : public BinaryStream
+{
+public:
+    static const size_t DefaultSegmentSize = 4 * 1024 * 1024;
+
+    SegmentedBufferStream(size_t segment_size = DefaultSegmentSize)
+        : m_segment_size(segment_size > 0 ? segment_size : DefaultSegmentSize), m_size(), m_wpos(), m_rpos() {}
+
+    size_t size() const             { return m_size; }
+    size_t getSegmentSize() const   { return m_segment_size; }
+    size_t getNumSegments() const   { return m_segments.size(); }
+    // written part of the i-th segment. only the last segment can be shorter than getSegmentSize().
+    DataRef getSegment(size_t i)
+    {
+        size_t begin = i * m_segment_size;
+        return DataRef(m_segments[i].ptr(), std::min<size_t>(m_segment_size, m_size - begin));
+    }
+
+    size_t tellg() override
+    {
+        return m_rpos;
+    }
+
+    void seekg(size_t pos) override
+    {
+        m_rpos = std::min<size_t>(pos, m_size);
+    }
+
+    size_t read(void *dst, size_t len) override
+    {
+        len = std::min<size_t>(len, m_size - m_rpos);
+        eachRange(m_rpos, len, [&dst](char *seg, size_t n) {
+            memcpy(dst, seg, n);
+            dst = (char*)dst + n;
+        });
+        m_rpos += len;
+        return len;
+    }
+
+
+    size_t tellp() override
+    {
+        return m_wpos;
+    }
+
+    void seekp(size_t pos) override
+    {
+        m_wpos = std::min<size_t>(pos, m_size);
+    }
+
+    size_t write(const void *data, size_t len) override
+    {
+        size_t required_size = m_wpos + len;
+        while (m_segments.size() * m_segment_size < required_size) {
+            m_segments.emplace_back(m_segment_size);
+        }
+        eachRange(m_wpos, len, [&data](char *seg, size_t n) {
+            memcpy(seg, data, n);
+            data = (const char*)data + n;
+        });
+        m_wpos += len;
+        m_size = std::max<size_t>(m_size, m_wpos);
+        return len;
+    }
+
+protected:
+    // Body: [](char *segment_data, size_t len) -> void. called for each segment that [pos, pos+len) overlaps.
+    template<class Body>
+    void eachRange(size_t pos, size_t len, const Body& body)
+    {
+        while (len > 0) {
+            size_t si = pos / m_segment_size;
+            size_t offset = pos % m_segment_size;
+            size_t n = std::min<size_t>(len, m_segment_size - offset);
+            body(m_segments[si].ptr() + offset, n);
+            pos += n;
+            len -= n;
+        }
+    }
+
+    std::vector<Buffer> m_segments;
+    size_t m_segment_size;
+    size_t m_size;
+    size_t m_wpos;
+    size_t m_rpos;
+};
+
+
 class StdOStream : public BinaryStream
 {
 public:
@@ -240,6 +382,11 @@ public:
         return len;
     }
 
+    void flush() override
+    {
+        m_os.flush();
+    }
+
 protected:
     std::ostream& m_os;
     bool m_delete_flag;
@@ -326,6 +473,11 @@ public:
         return len;
     }
 
+    void flush() override
+    {
+        m_ios.flush();
+    }
+
 protected:
     std::iostream& m_ios;
     bool m_delete_flag;
@@ -341,6 +493,14 @@ typedef size_t (*tellp_t)(void *obj);
 typedef void   (*seekp_t)(void *obj, size_t pos);
 typedef size_t (*write_t)(void *obj, const void *data, size_t len);
 
+// same layout as fcBufferData
+struct IOBuffer
+{
+    const void *data;
+    size_t size;
+};
+typedef size_t (*writev_t)(void *obj, const IOBuffer *buffers, int num_buffers);
+
 struct CustomStreamData
 {
     void *obj;
@@ -350,18 +510,34 @@ struct CustomStreamData
     tellp_t tellp;
     seekp_t seekp;
     write_t write;
+    writev_t writev; // optional
 
     CustomStreamData()
         : obj()
         , tellg(), seekg(), read()
-        , tellp(), seekp(), write()
+        , tellp(), seekp(), write(), writev()
     {}
 };
 
+// stream that calls user callbacks.
+// writes are combined in a buffer and seekp() / tellp() are handled locally, so the callbacks are called once per
+// buffer_size bytes instead of once per write() (e.g. each u32 of mp4 boxes). back-patches inside the buffer
+// never reach the callbacks. the callbacks see the data only after flush() or when the buffer is full.
+// a write callback that returns less than it is given marks the stream as failed.
 class CustomStream : public BinaryStream
 {
 public:
-    CustomStream(const CustomStreamData& csd) : m_csd(csd) {}
+    static const size_t DefaultBufferSize = 64 * 1024;
+
+    CustomStream(const CustomStreamData& csd, size_t buffer_size = DefaultBufferSize)
+        : m_csd(csd), m_buf_pos(), m_host_pos(), m_wpos(), m_failed(false)
+    {
+        m_buf.reserve(buffer_size);
+        if (m_csd.tellp) {
+            m_host_pos = m_wpos = m_buf_pos = m_csd.tellp(m_csd.obj);
+        }
+    }
+    ~CustomStream() { flush(); }
 
     CustomStreamData& get()             { return m_csd; }
     const CustomStreamData& get() const { return m_csd; }
@@ -378,27 +554,123 @@ public:
 
     size_t read(void *dst, size_t len) override
     {
+        flush();
         return m_csd.read(m_csd.obj, dst, len);
     }
 
 
     size_t tellp() override
     {
-        return m_csd.tellp(m_csd.obj);
+        return m_wpos;
     }
 
     void seekp(size_t pos) override
     {
-        return m_csd.seekp(m_csd.obj, pos);
+        m_wpos = pos;
     }
 
+    // return 0 if the data is passed to the callbacks directly and they fail to write it.
+    // failures of buffered data are reported by failed().
     size_t write(const void *data, size_t len) override
     {
-        return m_csd.write(m_csd.obj, data, len);
+        if (m_buf.empty()) {
+            m_buf_pos = m_wpos;
+        }
+        size_t end = m_wpos + len;
+        size_t buf_end = m_buf_pos + m_buf.size();
+        size_t ret = len;
+
+        if (m_wpos >= m_buf_pos && m_wpos <= buf_end && end <= m_buf_pos + m_buf.capacity()) {
+            // overwrite or append within the buffer
+            if (end > buf_end) {
+                m_buf.resize(end - m_buf_pos);
+            }
+            memcpy(m_buf.ptr() + (m_wpos - m_buf_pos), data, len);
+        }
+        else if (m_wpos == buf_end && m_csd.writev) {
+            // append that doesn't fit: pass the buffer and data in one call
+            IOBuffer buffers[] = { { m_buf.ptr(), m_buf.size() }, { data, len } };
+            hostSeek(m_buf_pos);
+            size_t total = m_buf.size() + len;
+            size_t written = m_csd.writev(m_csd.obj, buffers, 2);
+            m_host_pos = end;
+            m_buf.clear();
+            if (written != total) {
+                onHostWriteFailed();
+                ret = 0;
+            }
+        }
+        else if (end <= m_buf_pos) {
+            // patch to a range that is already passed to the callbacks
+            if (!hostWrite(m_wpos, data, len)) { ret = 0; }
+        }
+        else {
+            flushBuffer();
+            m_buf_pos = m_wpos;
+            if (len >= m_buf.capacity()) {
+                if (!hostWrite(m_wpos, data, len)) { ret = 0; }
+            }
+            else {
+                m_buf.assign(data, len);
+            }
+        }
+
+        m_wpos = end;
+        return ret;
+    }
+
+    // pass the buffered data to the callbacks and move the position of the callee to tellp()
+    void flush() override
+    {
+        flushBuffer();
+        hostSeek(m_wpos);
     }
 
+    // a write callback has returned less than it was given
+    bool failed() const override { return m_failed; }
+
 private:
+    void hostSeek(size_t pos)
+    {
+        if (m_host_pos != pos && m_csd.seekp) {
+            m_csd.seekp(m_csd.obj, pos);
+            m_host_pos = pos;
+        }
+    }
+
+    bool hostWrite(size_t pos, const void *data, size_t len)
+    {
+        hostSeek(pos);
+        size_t written = m_csd.write(m_csd.obj, data, len);
+        m_host_pos = pos + len;
+        if (written != len) {
+            onHostWriteFailed();
+            return false;
+        }
+        return true;
+    }
+
+    void onHostWriteFailed()
+    {
+        m_failed = true;
+        // the position of the callee is unknown. seek before the next write.
+        m_host_pos = (size_t)-1;
+    }
+
+    void flushBuffer()
+    {
+        if (m_buf.empty()) { return; }
+        hostWrite(m_buf_pos, m_buf.ptr(), m_buf.size());
+        m_buf_pos += m_buf.size();
+        m_buf.clear();
+    }
+
     CustomStreamData m_csd;
+    Buffer m_buf;
+    size_t m_buf_pos;   // stream position of m_buf[0]
+    size_t m_host_pos;  // position of the callee
+    size_t m_wpos;
+    bool m_failed;      // a write callback has failed
 };
 
 
@@ -0,0 +1,215 @@
+#ifndef ConvertKernelScalar_h
+#define ConvertKernelScalar_h
+
+// portable C++ version of ConvertKernel.ispc. conversions must match the ispc kernels.
+// covers all format pairs, including i16 / i32 sources that have no ispc kernels.
+// also used for all pairs when ispc is not built (see fcDisableISPCKernel), and as the baseline of benchmarks.
+
+namespace fcScalar {
+
+typedef uint8_t     u8;
+typedef uint16_t    i16;
+typedef int32_t     i32;
+typedef float       f32;
+// bits of a half. distinct type from i16 to pick the right conversion
+struct f16 { uint16_t bits; };
+
+
+inline f32 half_to_float(f16 h)
+{
+    uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+    uint32_t exponent = (h.bits >> 10) & 0x1f;
+    uint32_t mantissa = h.bits & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // denormal. normalize it
+            exponent = 113;
+            while ((mantissa & 0x400) == 0) { mantissa <<= 1; --exponent; }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13); // inf / nan
+    }
+    else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    f32 ret;
+    memcpy(&ret, &bits, 4);
+    return ret;
+}
+
+// round to nearest even, same as F16C
+inline f16 float_to_half(f32 f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, 4);
+    uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+    bits &= 0x7fffffff;
+
+    f16 ret;
+    if (bits >= 0x7f800000) {
+        ret.bits = sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00); // nan / inf
+    }
+    else if (bits >= 0x477ff000) {
+        ret.bits = sign | 0x7c00; // overflow
+    }
+    else if (bits < 0x38800000) {
+        // denormal or zero
+        if (bits < 0x33000000) {
+            ret.bits = sign;
+        }
+        else {
+            int shift = 126 - int(bits >> 23);
+            uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+            uint32_t v = mantissa >> (shift + 1);
+            uint32_t rest = mantissa & ((1u << (shift + 1)) - 1);
+            uint32_t half_way = 1u << shift;
+            if (rest > half_way || (rest == half_way && (v & 1))) { ++v; }
+            ret.bits = uint16_t(sign | v);
+        }
+    }
+    else {
+        uint32_t v = bits - 0x38000000; // rebias exponent
+        v += 0xfff + ((v >> 13) & 1);
+        ret.bits = uint16_t(sign | (v >> 13));
+    }
+    return ret;
+}
+
+inline uint32_t signbits(f32 v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, 4);
+    return bits & 0x80000000;
+}
+
+
+inline u8 to_u8(u8 v)   { return v; }
+inline u8 to_u8(i16 v)  { return v & 0xff; }
+inline u8 to_u8(i32 v)  { return v & 0xff; }
+inline u8 to_u8(f32 v)  { return (int)(v * 255.0f) & 0xff; }
+inline u8 to_u8(f16 v)  { return to_u8(half_to_float(v)); }
+
+inline i16 to_i16(u8 v)  { return v; }
+inline i16 to_i16(i16 v) { return v; }
+inline i16 to_i16(i32 v) { return i16(v & 0xffff); }
+inline i16 to_i16(f32 v) { return i16((int)(v * 255.0f) | (signbits(v) >> 16)); }
+inline i16 to_i16(f16 v) { return to_i16(half_to_float(v)); }
+
+inline i32 to_i32(u8 v)  { return v; }
+inline i32 to_i32(i16 v) { return v; }
+inline i32 to_i32(i32 v) { return v; }
+inline i32 to_i32(f32 v) { return (int)(v * 255.0f); }
+inline i32 to_i32(f16 v) { return to_i32(half_to_float(v)); }
+
+inline f16 to_f16(u8 v)  { return float_to_half((f32)((int)v) / 255.0f); }
+inline f16 to_f16(i16 v) { return float_to_half((f32)((int)v) / 255.0f); }
+inline f16 to_f16(i32 v) { return float_to_half((f32)v / 255.0f); }
+inline f16 to_f16(f16 v) { return v; }
+inline f16 to_f16(f32 v) { return float_to_half(v); }
+
+inline f32 to_f32(u8 v)  { return (f32)((int)v) / 255.0f; }
+inline f32 to_f32(i16 v) { return (f32)((int)v) / 255.0f; }
+inline f32 to_f32(i32 v) { return (f32)v / 255.0f; }
+inline f32 to_f32(f16 v) { return half_to_float(v); }
+inline f32 to_f32(f32 v) { return v; }
+
+template<class T> struct Cast;
+template<> struct Cast<u8>  { template<class S> static u8  get(S v) { return to_u8(v); } };
+template<> struct Cast<i16> { template<class S> static i16 get(S v) { return to_i16(v); } };
+template<> struct Cast<i32> { template<class S> static i32 get(S v) { return to_i32(v); } };
+template<> struct Cast<f16> { template<class S> static f16 get(S v) { return to_f16(v); } };
+template<> struct Cast<f32> { template<class S> static f32 get(S v) { return to_f32(v); } };
+
+
+// DC / SC: number of channels. missing channels are filled with 0, and alpha with 1.
+template<class DT, int DC, class ST, int SC>
+struct Converter
+{
+    static void convert(void *dst_, const void *src_, size_t size)
+    {
+        DT *dst = (DT*)dst_;
+        const ST *src = (const ST*)src_;
+        const DT zero = Cast<DT>::get(0.0f);
+        const DT one = Cast<DT>::get(1.0f);
+        for (size_t i = 0; i < size; ++i) {
+            for (int c = 0; c < DC; ++c) {
+                dst[i * DC + c] = c < SC ? Cast<DT>::get(src[i * SC + c]) : (c == 3 ? one : zero);
+            }
+        }
+    }
+
+    static void convertImage(void *dst, int dst_pitch, const void *src, int src_pitch, int width, int height, bool flip_y)
+    {
+        for (int y = 0; y < height; ++y) {
+            int sy = flip_y ? height - 1 - y : y;
+            convert((char*)dst + (ptrdiff_t)dst_pitch * y, (const char*)src + (ptrdiff_t)src_pitch * sy, width);
+        }
+    }
+};
+
+template<class DT, class ST, class Body>
+void EachChannels(fcPixelFormat dt, fcPixelFormat st, const Body& body)
+{
+#define fcEach(DC, SC) body(fcPixelFormat(dt | DC), fcPixelFormat(st | SC), &Converter<DT, DC, ST, SC>::convert, &Converter<DT, DC, ST, SC>::convertImage);
+    fcEach(1, 1) fcEach(1, 2) fcEach(1, 3) fcEach(1, 4)
+    fcEach(2, 1) fcEach(2, 2) fcEach(2, 3) fcEach(2, 4)
+    fcEach(3, 1) fcEach(3, 2) fcEach(3, 3) fcEach(3, 4)
+    fcEach(4, 1) fcEach(4, 2) fcEach(4, 3) fcEach(4, 4)
+#undef fcEach
+}
+
+template<class ST, class Body>
+void EachDstType(fcPixelFormat st, const Body& body)
+{
+    EachChannels<u8, ST>(fcPixelFormat_Type_u8, st, body);
+    EachChannels<i16, ST>(fcPixelFormat_Type_i16, st, body);
+    EachChannels<i32, ST>(fcPixelFormat_Type_i32, st, body);
+    EachChannels<f16, ST>(fcPixelFormat_Type_f16, st, body);
+    EachChannels<f32, ST>(fcPixelFormat_Type_f32, st, body);
+}
+
+// call body(dstfmt, srcfmt, kernel, image_kernel) for every pair of formats (including dstfmt == srcfmt).
+template<class Body>
+void EachKernel(const Body& body)
+{
+    EachDstType<u8>(fcPixelFormat_Type_u8, body);
+    EachDstType<i16>(fcPixelFormat_Type_i16, body);
+    EachDstType<i32>(fcPixelFormat_Type_i32, body);
+    EachDstType<f16>(fcPixelFormat_Type_f16, body);
+    EachDstType<f32>(fcPixelFormat_Type_f32, body);
+}
+
+
+inline void Scale(u8 *data, size_t size, float scale)
+{
+    for (size_t i = 0; i < size; ++i) { data[i] = u8(std::min<int>((int)((f32)((int)data[i]) * scale), 0xff)); }
+}
+inline void Scale(i16 *data, size_t size, float scale)
+{
+    for (size_t i = 0; i < size; ++i) {
+        f32 t = (f32)((int)data[i]) * scale;
+        data[i] = i16(((int)t & 0x7fff) | (signbits(t) >> 16));
+    }
+}
+inline void Scale(i32 *data, size_t size, float scale)
+{
+    for (size_t i = 0; i < size; ++i) { data[i] = (i32)((f32)data[i] * scale); }
+}
+inline void Scale(f16 *data, size_t size, float scale)
+{
+    for (size_t i = 0; i < size; ++i) { data[i] = float_to_half(half_to_float(data[i]) * scale); }
+}
+inline void Scale(f32 *data, size_t size, float scale)
+{
+    for (size_t i = 0; i < size; ++i) { data[i] *= scale; }
+}
+
+} // namespace fcScalar
+
+#endif // ConvertKernelScalar_h
@@ -0,0 +1,950 @@
+#include "pch.h"
+#include "fcFoundation.h"
+
+#include "fcThreadPool.h"
+#include <climits>
+
+#ifdef fcWindows
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #ifdef fcLinux
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+        #if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+            #define fcSupportIOUring
+        #endif
+    #endif
+#endif
+
+
+#ifdef fcWindows
+
+// INVALID_HANDLE_VALUE is -1
+static intptr_t fcFileOpen(const char *path)
+{
+    return (intptr_t)::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+static void fcFileClose(intptr_t f)
+{
+    ::CloseHandle((HANDLE)f);
+}
+
+static size_t fcFileWriteAt(intptr_t f, const void *data, size_t len, size_t pos)
+{
+    size_t total = 0;
+    while (total < len) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(pos + total);
+        ov.OffsetHigh = (DWORD)((uint64_t)(pos + total) >> 32);
+        DWORD n = 0;
+        DWORD req = (DWORD)std::min<size_t>(len - total, 0x40000000);
+        if (!::WriteFile((HANDLE)f, (const char*)data + total, req, &n, &ov) || n == 0) { break; }
+        total += n;
+    }
+    return total;
+}
+
+static size_t fcFileReadAt(intptr_t f, void *dst, size_t len, size_t pos)
+{
+    size_t total = 0;
+    while (total < len) {
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(pos + total);
+        ov.OffsetHigh = (DWORD)((uint64_t)(pos + total) >> 32);
+        DWORD n = 0;
+        DWORD req = (DWORD)std::min<size_t>(len - total, 0x40000000);
+        if (!::ReadFile((HANDLE)f, (char*)dst + total, req, &n, &ov) || n == 0) { break; }
+        total += n;
+    }
+    return total;
+}
+
+#else // fcWindows
+
+static intptr_t fcFileOpen(const char *path)
+{
+    return ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+}
+
+static void fcFileClose(intptr_t f)
+{
+    ::close((int)f);
+}
+
+static size_t fcFileWriteAt(intptr_t f, const void *data, size_t len, size_t pos)
+{
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = ::pwrite((int)f, (const char*)data + total, len - total, (off_t)(pos + total));
+        if (n <= 0) { break; }
+        total += n;
+    }
+    return total;
+}
+
+static size_t fcFileReadAt(intptr_t f, void *dst, size_t len, size_t pos)
+{
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = ::pread((int)f, (char*)dst + total, len - total, (off_t)(pos + total));
+        if (n <= 0) { break; }
+        total += n;
+    }
+    return total;
+}
+
+#endif // fcWindows
+
+
+FileStream::FileStream(const char *path, size_t buffer_size)
+    : m_file(fcFileOpen(path))
+    , m_buf_pos(), m_size(), m_wpos(), m_rpos(), m_failed(false)
+{
+    if (!isOpened()) {
+        fcDebugLog("FileStream::FileStream(): failed to open %s", path);
+    }
+    m_buf.reserve(buffer_size > 0 ? buffer_size : DefaultBufferSize);
+}
+
+FileStream::~FileStream()
+{
+    if (isOpened()) {
+        flush();
+        fcFileClose(m_file);
+    }
+}
+
+bool FileStream::isOpened() const
+{
+    return m_file != -1;
+}
+
+void FileStream::flush()
+{
+    if (m_buf.empty()) { return; }
+    writeDirect(m_buf.ptr(), m_buf.size(), m_buf_pos);
+    m_buf_pos += m_buf.size();
+    m_buf.clear();
+}
+
+bool FileStream::failed() const
+{
+    return !isOpened() || m_failed;
+}
+
+size_t FileStream::writeDirect(const void *data, size_t len, size_t pos)
+{
+    if (!isOpened()) { return 0; }
+    size_t written = fcFileWriteAt(m_file, data, len, pos);
+    if (written != len) {
+        fcDebugLog("FileStream::writeDirect(): write failed");
+        m_failed = true;
+    }
+    return written;
+}
+
+
+size_t FileStream::tellg()
+{
+    return m_rpos;
+}
+
+void FileStream::seekg(size_t pos)
+{
+    m_rpos = std::min<size_t>(pos, m_size);
+}
+
+size_t FileStream::read(void *dst, size_t len)
+{
+    if (!isOpened()) { return 0; }
+    flush();
+    size_t n = fcFileReadAt(m_file, dst, std::min<size_t>(len, m_size - m_rpos), m_rpos);
+    m_rpos += n;
+    return n;
+}
+
+
+size_t FileStream::tellp()
+{
+    return m_wpos;
+}
+
+void FileStream::seekp(size_t pos)
+{
+    m_wpos = std::min<size_t>(pos, m_size);
+}
+
+size_t FileStream::write(const void *data, size_t len)
+{
+    if (!isOpened()) { return 0; }
+
+    size_t end = m_wpos + len;
+    size_t buf_end = m_buf_pos + m_buf.size();
+    size_t ret = len;
+
+    if (end <= m_buf_pos) {
+        // patch to a range that is already flushed
+        ret = writeDirect(data, len, m_wpos);
+    }
+    else if (m_wpos >= m_buf_pos && m_wpos <= buf_end && end <= m_buf_pos + m_buf.capacity()) {
+        // overwrite or append within the buffer
+        if (end > buf_end) {
+            m_buf.resize(end - m_buf_pos);
+        }
+        memcpy(m_buf.ptr() + (m_wpos - m_buf_pos), data, len);
+    }
+    else {
+        flush();
+        m_buf_pos = m_wpos;
+        if (len >= m_buf.capacity()) {
+            ret = writeDirect(data, len, m_wpos);
+            m_buf_pos = end;
+        }
+        else {
+            m_buf.assign(data, len);
+        }
+    }
+
+    m_wpos = end;
+    m_size = std::max<size_t>(m_size, end);
+    return ret;
+}
+
+
+
+// -------------------------------------------------------------
+// MappedFileStream
+// -------------------------------------------------------------
+
+static size_t fcGetMapGranularity()
+{
+#ifdef fcWindows
+    SYSTEM_INFO info;
+    ::GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+MappedFileStream::MappedFileStream(const char *path, size_t window_size)
+    : m_file(fcFileOpen(path))
+    , m_mapping()
+    , m_window()
+    , m_window_pos()
+    , m_window_size()
+    , m_capacity(), m_size(), m_wpos(), m_rpos(), m_failed(false)
+{
+    if (!isOpened()) {
+        fcDebugLog("MappedFileStream::MappedFileStream(): failed to open %s", path);
+    }
+    size_t granularity = fcGetMapGranularity();
+    if (window_size == 0) { window_size = DefaultWindowSize; }
+    m_window_size = (window_size + granularity - 1) / granularity * granularity;
+}
+
+MappedFileStream::~MappedFileStream()
+{
+    if (!isOpened()) { return; }
+
+    unmapWindow();
+#ifdef fcWindows
+    if (m_mapping) { ::CloseHandle((HANDLE)m_mapping); }
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)m_size;
+    ::SetFilePointerEx((HANDLE)m_file, size, nullptr, FILE_BEGIN);
+    ::SetEndOfFile((HANDLE)m_file);
+#else
+    if (::ftruncate((int)m_file, (off_t)m_size) != 0) {
+        fcDebugLog("MappedFileStream::~MappedFileStream(): ftruncate failed");
+    }
+#endif
+    fcFileClose(m_file);
+}
+
+bool MappedFileStream::isOpened() const
+{
+    return m_file != -1;
+}
+
+void MappedFileStream::flush()
+{
+    if (!m_window) { return; }
+#ifdef fcWindows
+    ::FlushViewOfFile(m_window, 0);
+#else
+    ::msync(m_window, m_window_size, MS_ASYNC);
+#endif
+}
+
+bool MappedFileStream::failed() const
+{
+    return !isOpened() || m_failed;
+}
+
+bool MappedFileStream::growFile(size_t size)
+{
+#ifdef fcWindows
+    if (m_mapping) {
+        ::CloseHandle((HANDLE)m_mapping);
+        m_mapping = 0;
+    }
+    LARGE_INTEGER li;
+    li.QuadPart = (LONGLONG)size;
+    if (!::SetFilePointerEx((HANDLE)m_file, li, nullptr, FILE_BEGIN) || !::SetEndOfFile((HANDLE)m_file)) {
+        return false;
+    }
+    // the mapping object can't grow. create a new one with the new file size.
+    m_mapping = (intptr_t)::CreateFileMappingA((HANDLE)m_file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    if (!m_mapping) { return false; }
+#else
+    bool allocated = false;
+#ifdef fcLinux
+    // reserve disk blocks so that writing to the mapping doesn't fail (SIGBUS) on disk full.
+    // fall back to a sparse file only if the file system can't reserve blocks. other errors (ENOSPC etc) are failures.
+    if (::fallocate((int)m_file, 0, (off_t)m_capacity, (off_t)(size - m_capacity)) == 0) {
+        allocated = true;
+    }
+    else if (errno != EOPNOTSUPP) {
+        fcDebugLog("MappedFileStream::growFile(): fallocate failed (%d)", errno);
+        return false;
+    }
+#endif
+    if (!allocated && ::ftruncate((int)m_file, (off_t)size) != 0) {
+        return false;
+    }
+#endif
+    m_capacity = size;
+    return true;
+}
+
+bool MappedFileStream::mapWindow(size_t pos)
+{
+    unmapWindow();
+
+    size_t window_pos = pos / m_window_size * m_window_size;
+    if (window_pos + m_window_size > m_capacity && !growFile(window_pos + m_window_size)) {
+        fcDebugLog("MappedFileStream::mapWindow(): failed to grow the file");
+        m_failed = true;
+        return false;
+    }
+
+#ifdef fcWindows
+    m_window = (char*)::MapViewOfFile((HANDLE)m_mapping, FILE_MAP_READ | FILE_MAP_WRITE,
+        (DWORD)((uint64_t)window_pos >> 32), (DWORD)window_pos, m_window_size);
+#else
+    void *p = ::mmap(nullptr, m_window_size, PROT_READ | PROT_WRITE, MAP_SHARED, (int)m_file, (off_t)window_pos);
+    m_window = p == MAP_FAILED ? nullptr : (char*)p;
+#endif
+    if (!m_window) {
+        fcDebugLog("MappedFileStream::mapWindow(): failed to map the file");
+        m_failed = true;
+        return false;
+    }
+    m_window_pos = window_pos;
+    return true;
+}
+
+void MappedFileStream::unmapWindow()
+{
+    if (!m_window) { return; }
+#ifdef fcWindows
+    ::UnmapViewOfFile(m_window);
+#else
+    ::munmap(m_window, m_window_size);
+#endif
+    m_window = nullptr;
+}
+
+template<class Body>
+size_t MappedFileStream::eachWindow(size_t pos, size_t len, const Body& body)
+{
+    size_t done = 0;
+    while (done < len) {
+        size_t p = pos + done;
+        if (!m_window || p < m_window_pos || p >= m_window_pos + m_window_size) {
+            if (!mapWindow(p)) { break; }
+        }
+        size_t offset = p - m_window_pos;
+        size_t n = std::min<size_t>(len - done, m_window_size - offset);
+        body(m_window + offset, n);
+        done += n;
+    }
+    return done;
+}
+
+
+size_t MappedFileStream::tellg()
+{
+    return m_rpos;
+}
+
+void MappedFileStream::seekg(size_t pos)
+{
+    m_rpos = std::min<size_t>(pos, m_size);
+}
+
+size_t MappedFileStream::read(void *dst, size_t len)
+{
+    if (!isOpened()) { return 0; }
+    char *d = (char*)dst;
+    size_t n = eachWindow(m_rpos, std::min<size_t>(len, m_size - m_rpos), [&d](char *src, size_t n) {
+        memcpy(d, src, n);
+        d += n;
+    });
+    m_rpos += n;
+    return n;
+}
+
+
+size_t MappedFileStream::tellp()
+{
+    return m_wpos;
+}
+
+void MappedFileStream::seekp(size_t pos)
+{
+    m_wpos = std::min<size_t>(pos, m_size);
+}
+
+size_t MappedFileStream::write(const void *data, size_t len)
+{
+    if (!isOpened()) { return 0; }
+    const char *s = (const char*)data;
+    size_t n = eachWindow(m_wpos, len, [&s](char *dst, size_t n) {
+        memcpy(dst, s, n);
+        s += n;
+    });
+    m_wpos += n;
+    m_size = std::max<size_t>(m_size, m_wpos);
+    return n;
+}
+
+
+
+// -------------------------------------------------------------
+// AsyncFileStream
+// -------------------------------------------------------------
+
+class fcAsyncWriteBackend
+{
+public:
+    fcAsyncWriteBackend() : m_failed(false) {}
+    virtual ~fcAsyncWriteBackend() {}
+    virtual bool isIOUring() const { return false; }
+    // max number of writes that can be pending at the same time
+    virtual int getMaxPendingWrites() const = 0;
+    // ordered: the write must not start before all previously submitted writes are completed
+    virtual void submit(Buffer &&buf, size_t pos, bool ordered) = 0;
+    // move buffers of completed writes to dst. if wait is true, block until at least one write is completed.
+    virtual void reap(std::vector<Buffer> &dst, bool wait) = 0;
+    // a completed write failed
+    bool failed() const { return m_failed; }
+
+protected:
+    std::atomic<bool> m_failed;
+};
+
+
+// processes writes in submission order on a dedicated thread. used where io_uring is not available.
+class fcAsyncWriteThread : public fcAsyncWriteBackend
+{
+public:
+    fcAsyncWriteThread(intptr_t file);
+    ~fcAsyncWriteThread() override;
+    int getMaxPendingWrites() const override { return INT_MAX; }
+    void submit(Buffer &&buf, size_t pos, bool ordered) override;
+    void reap(std::vector<Buffer> &dst, bool wait) override;
+
+private:
+    void process();
+
+    struct Op
+    {
+        Buffer buf;
+        size_t pos;
+    };
+
+    intptr_t m_file;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_queue;
+    std::condition_variable m_cond_done;
+    std::deque<Op> m_queue;
+    std::vector<Buffer> m_done;
+    bool m_stop;
+    std::thread m_thread;
+};
+
+fcAsyncWriteThread::fcAsyncWriteThread(intptr_t file)
+    : m_file(file)
+    , m_stop(false)
+{
+    m_thread = std::thread([this]() { process(); });
+}
+
+fcAsyncWriteThread::~fcAsyncWriteThread()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond_queue.notify_one();
+    m_thread.join();
+}
+
+void fcAsyncWriteThread::submit(Buffer &&buf, size_t pos, bool /*ordered*/)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queue.push_back(Op{ std::move(buf), pos });
+    }
+    m_cond_queue.notify_one();
+}
+
+void fcAsyncWriteThread::reap(std::vector<Buffer> &dst, bool wait)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (wait) {
+        m_cond_done.wait(lock, [this]() { return !m_done.empty(); });
+    }
+    for (auto& buf : m_done) {
+        dst.push_back(std::move(buf));
+    }
+    m_done.clear();
+}
+
+void fcAsyncWriteThread::process()
+{
+    fcApplyWorkerThreadConfig("FileWriter");
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_cond_queue.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty()) { break; }
+
+        Op op = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+        if (fcFileWriteAt(m_file, op.buf.ptr(), op.buf.size(), op.pos) != op.buf.size()) {
+            fcDebugLog("fcAsyncWriteThread::process(): write failed");
+            m_failed = true;
+        }
+        lock.lock();
+
+        m_done.push_back(std::move(op.buf));
+        m_cond_done.notify_one();
+    }
+}
+
+
+#ifdef fcSupportIOUring
+
+// io_uring through raw syscalls (linux 5.6 or later, for IORING_OP_WRITE). the submission and completion queues
+// are only touched by the thread that uses the stream, so no lock is needed.
+// ordered writes are held back here until all earlier writes are completed, including the rest of short writes.
+// (IOSQE_IO_DRAIN can't do that: the rest of a short write is queued after the completion is reaped,
+// and by then a drained patch to the same range may already be written)
+class fcIOUringBackend : public fcAsyncWriteBackend
+{
+public:
+    static fcAsyncWriteBackend* create(intptr_t file);
+    ~fcIOUringBackend() override;
+    bool isIOUring() const override { return true; }
+    int getMaxPendingWrites() const override { return (int)m_entries; }
+    void submit(Buffer &&buf, size_t pos, bool ordered) override;
+    void reap(std::vector<Buffer> &dst, bool wait) override;
+
+private:
+    fcIOUringBackend(intptr_t file);
+    bool setup(unsigned entries);
+    // write the rest of the op. if it can't be submitted, it is written synchronously and completed on the next reap().
+    void queueWrite(int op_index);
+    // queue deferred writes up to the next ordered one that can't start yet
+    void queueDeferred();
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+    struct Op
+    {
+        Buffer buf;
+        size_t pos;
+        size_t written;
+        bool ordered;
+    };
+
+    intptr_t m_file;
+    int m_ring;
+    unsigned m_entries;
+    void *m_sq_ptr, *m_cq_ptr;
+    size_t m_sq_size, m_cq_size;
+    io_uring_sqe *m_sqes;
+    unsigned *m_sq_tail, *m_sq_mask, *m_sq_array;
+    unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+    io_uring_cqe *m_cqes;
+    std::vector<Op> m_ops;
+    std::vector<int> m_free_ops;
+    std::deque<int> m_deferred;     // submitted ops waiting for an earlier ordered op to start
+    std::vector<int> m_sync_done;   // ops that are written synchronously
+    int m_num_queued;               // ops queued to the ring or in m_sync_done
+};
+
+fcAsyncWriteBackend* fcIOUringBackend::create(intptr_t file)
+{
+    auto *ret = new fcIOUringBackend(file);
+    if (!ret->setup(64)) {
+        delete ret;
+        ret = nullptr;
+    }
+    return ret;
+}
+
+fcIOUringBackend::fcIOUringBackend(intptr_t file)
+    : m_file(file), m_ring(-1), m_entries()
+    , m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED), m_sq_size(), m_cq_size(), m_sqes((io_uring_sqe*)MAP_FAILED)
+    , m_sq_tail(), m_sq_mask(), m_sq_array()
+    , m_cq_head(), m_cq_tail(), m_cq_mask(), m_cqes()
+    , m_num_queued()
+{
+}
+
+fcIOUringBackend::~fcIOUringBackend()
+{
+    if (m_sqes != MAP_FAILED) { munmap(m_sqes, m_entries * sizeof(io_uring_sqe)); }
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) { munmap(m_cq_ptr, m_cq_size); }
+    if (m_sq_ptr != MAP_FAILED) { munmap(m_sq_ptr, m_sq_size); }
+    if (m_ring >= 0) { ::close(m_ring); }
+}
+
+bool fcIOUringBackend::setup(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_ring = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (m_ring < 0) { return false; } // not supported or not permitted
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0) { return false; } // older than 5.6: no IORING_OP_WRITE
+
+    m_entries = params.sq_entries;
+    m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+        m_sq_size = m_cq_size = std::max<size_t>(m_sq_size, m_cq_size);
+    }
+
+    m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED) { return false; }
+    m_cq_ptr = single_mmap ? m_sq_ptr :
+        mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_CQ_RING);
+    if (m_cq_ptr == MAP_FAILED) { return false; }
+    m_sqes = (io_uring_sqe*)mmap(nullptr, m_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) { return false; }
+
+    char *sq = (char*)m_sq_ptr;
+    m_sq_tail   = (unsigned*)(sq + params.sq_off.tail);
+    m_sq_mask   = (unsigned*)(sq + params.sq_off.ring_mask);
+    m_sq_array  = (unsigned*)(sq + params.sq_off.array);
+    char *cq = (char*)m_cq_ptr;
+    m_cq_head   = (unsigned*)(cq + params.cq_off.head);
+    m_cq_tail   = (unsigned*)(cq + params.cq_off.tail);
+    m_cq_mask   = (unsigned*)(cq + params.cq_off.ring_mask);
+    m_cqes      = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    m_ops.resize(m_entries);
+    for (int i = (int)m_entries - 1; i >= 0; --i) {
+        m_free_ops.push_back(i);
+    }
+    return true;
+}
+
+int fcIOUringBackend::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int ret;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, m_ring, to_submit, min_complete, flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        fcDebugLog("fcIOUringBackend::enter(): io_uring_enter failed (%d)", errno);
+    }
+    return ret;
+}
+
+void fcIOUringBackend::queueWrite(int op_index)
+{
+    Op &op = m_ops[op_index];
+
+    // the caller never has more than m_entries writes pending, so the queue can't be full
+    unsigned tail = *m_sq_tail;
+    unsigned index = tail & *m_sq_mask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = (int)m_file;
+    sqe->addr = (uint64_t)(op.buf.ptr() + op.written);
+    sqe->len = (uint32_t)(op.buf.size() - op.written);
+    sqe->off = (uint64_t)(op.pos + op.written);
+    sqe->user_data = (uint64_t)op_index;
+    m_sq_array[index] = index;
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (enter(1, 0, 0) < 1) {
+        // the kernel didn't consume the entry (it fails only when nothing is consumed). take it back,
+        // otherwise a later io_uring_enter() would submit it, and write the data here.
+        __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+        size_t len = op.buf.size() - op.written;
+        if (fcFileWriteAt(m_file, op.buf.ptr() + op.written, len, op.pos + op.written) != len) {
+            fcDebugLog("fcIOUringBackend::queueWrite(): write failed");
+            m_failed = true;
+        }
+        m_sync_done.push_back(op_index);
+    }
+}
+
+void fcIOUringBackend::queueDeferred()
+{
+    while (!m_deferred.empty()) {
+        int op_index = m_deferred.front();
+        // an ordered write starts after all earlier writes are completed, so a patch is never overwritten by an older write
+        if (m_ops[op_index].ordered && m_num_queued > 0) { break; }
+        m_deferred.pop_front();
+        ++m_num_queued;
+        queueWrite(op_index);
+    }
+}
+
+void fcIOUringBackend::submit(Buffer &&buf, size_t pos, bool ordered)
+{
+    int op_index = m_free_ops.back();
+    m_free_ops.pop_back();
+
+    Op &op = m_ops[op_index];
+    op.buf = std::move(buf);
+    op.pos = pos;
+    op.written = 0;
+    op.ordered = ordered;
+    m_deferred.push_back(op_index);
+    queueDeferred();
+}
+
+void fcIOUringBackend::reap(std::vector<Buffer> &dst, bool wait)
+{
+    auto complete = [&](int op_index) {
+        dst.push_back(std::move(m_ops[op_index].buf));
+        m_free_ops.push_back(op_index);
+        --m_num_queued;
+    };
+
+    for (;;) {
+        bool reaped = !m_sync_done.empty();
+        // completing an op may let a deferred one start, which may complete synchronously again
+        while (!m_sync_done.empty()) {
+            std::vector<int> done;
+            done.swap(m_sync_done);
+            for (int op_index : done) { complete(op_index); }
+            queueDeferred();
+        }
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+            int op_index = (int)cqe.user_data;
+            Op &op = m_ops[op_index];
+            if (cqe.res > 0 && op.written + cqe.res < op.buf.size()) {
+                // short write. write the rest. ordered writes that may overlap it are still deferred.
+                op.written += cqe.res;
+                queueWrite(op_index);
+                continue;
+            }
+            if (cqe.res <= 0 && op.buf.size() > 0) {
+                fcDebugLog("fcIOUringBackend::reap(): write failed (%d)", -cqe.res);
+                m_failed = true;
+            }
+            complete(op_index);
+            reaped = true;
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        queueDeferred();
+
+        if (reaped || !wait || m_free_ops.size() == m_entries) { break; }
+        if (!m_sync_done.empty()) { continue; }
+        if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0) { break; }
+    }
+}
+
+#endif // fcSupportIOUring
+
+
+AsyncFileStream::AsyncFileStream(const char *path, size_t max_pending_bytes, size_t block_size, bool use_io_uring)
+    : m_file(fcFileOpen(path))
+    , m_block_pos()
+    , m_block_size(block_size > 0 ? block_size : DefaultBlockSize)
+    , m_max_pending_bytes(max_pending_bytes > 0 ? max_pending_bytes : DefaultMaxPendingBytes)
+    , m_pending_bytes(), m_num_pending()
+    , m_size(), m_wpos(), m_rpos()
+{
+    if (!isOpened()) {
+        fcDebugLog("AsyncFileStream::AsyncFileStream(): failed to open %s", path);
+        return;
+    }
+#ifdef fcSupportIOUring
+    if (use_io_uring) {
+        m_backend.reset(fcIOUringBackend::create(m_file));
+    }
+#endif
+    if (!m_backend) {
+        m_backend.reset(new fcAsyncWriteThread(m_file));
+    }
+    m_block.reserve(m_block_size);
+}
+
+AsyncFileStream::~AsyncFileStream()
+{
+    if (isOpened()) {
+        flush();
+        m_backend.reset();
+        fcFileClose(m_file);
+    }
+}
+
+bool AsyncFileStream::isOpened() const
+{
+    return m_file != -1;
+}
+
+bool AsyncFileStream::failed() const
+{
+    return !m_backend || m_backend->failed();
+}
+
+bool AsyncFileStream::isUsingIOUring() const
+{
+    return m_backend && m_backend->isIOUring();
+}
+
+void AsyncFileStream::flush()
+{
+    if (!m_backend) { return; }
+    submitBlock();
+    while (m_num_pending > 0) {
+        reap(true);
+    }
+}
+
+void AsyncFileStream::submit(Buffer &&buf, size_t pos, bool ordered)
+{
+    size_t size = buf.size();
+    reap(false);
+    while (m_num_pending > 0 &&
+        (m_pending_bytes + size > m_max_pending_bytes || m_num_pending >= m_backend->getMaxPendingWrites()))
+    {
+        reap(true);
+    }
+
+    m_backend->submit(std::move(buf), pos, ordered);
+    m_pending_bytes += size;
+    ++m_num_pending;
+}
+
+void AsyncFileStream::submitBlock()
+{
+    if (m_block.empty()) { return; }
+
+    Buffer next;
+    if (!m_free_blocks.empty()) {
+        next = std::move(m_free_blocks.back());
+        m_free_blocks.pop_back();
+    }
+    else {
+        next.reserve(m_block_size);
+    }
+
+    size_t pos = m_block_pos;
+    m_block_pos += m_block.size();
+    submit(std::move(m_block), pos, false);
+    m_block = std::move(next);
+}
+
+void AsyncFileStream::reap(bool wait)
+{
+    m_backend->reap(m_completed, wait);
+    for (auto& buf : m_completed) {
+        m_pending_bytes -= buf.size();
+        --m_num_pending;
+        // recycle blocks. patch buffers are just released.
+        if (buf.capacity() == m_block_size) {
+            buf.clear();
+            m_free_blocks.push_back(std::move(buf));
+        }
+    }
+    m_completed.clear();
+}
+
+
+size_t AsyncFileStream::tellg()
+{
+    return m_rpos;
+}
+
+void AsyncFileStream::seekg(size_t pos)
+{
+    m_rpos = std::min<size_t>(pos, m_size);
+}
+
+size_t AsyncFileStream::read(void *dst, size_t len)
+{
+    if (!isOpened()) { return 0; }
+    flush();
+    size_t n = fcFileReadAt(m_file, dst, std::min<size_t>(len, m_size - m_rpos), m_rpos);
+    m_rpos += n;
+    return n;
+}
+
+
+size_t AsyncFileStream::tellp()
+{
+    return m_wpos;
+}
+
+void AsyncFileStream::seekp(size_t pos)
+{
+    m_wpos = std::min<size_t>(pos, m_size);
+}
+
+size_t AsyncFileStream::write(const void *data, size_t len)
+{
+    if (!m_backend) { return 0; }
+
+    // m_block is always the tail of the file: [m_block_pos, m_size). m_wpos <= m_size.
+    const char *src = (const char*)data;
+    size_t pos = m_wpos;
+    size_t remain = len;
+    while (remain > 0) {
+        size_t n;
+        if (pos < m_block_pos) {
+            // patch to an already submitted range
+            n = std::min<size_t>(remain, m_block_pos - pos);
+            submit(Buffer(src, n), pos, true);
+        }
+        else {
+            size_t offset = pos - m_block_pos;
+            n = std::min<size_t>(remain, m_block_size - offset);
+            if (offset + n > m_block.size()) {
+                m_block.resize(offset + n);
+            }
+            memcpy(m_block.ptr() + offset, src, n);
+            if (m_block.size() == m_block_size) {
+                submitBlock();
+            }
+        }
+        src += n;
+        pos += n;
+        remain -= n;
+    }
+
+    m_wpos = pos;
+    m_size = std::max<size_t>(m_size, pos);
+    return len;
+}
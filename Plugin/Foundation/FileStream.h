@@ -0,0 +1,143 @@
+#ifndef fcFileStream_h
+#define fcFileStream_h
+
+#include <memory>
+#include <vector>
+
+// file stream that writes through the OS file API with a large user-space buffer.
+// positions are tracked here, so tellp() / seekp() never reach the OS.
+// writes inside or just after the buffered range (e.g. box size patches of the mp4 writer) are coalesced in the buffer,
+// patches to already flushed ranges are written directly with a positional write (pwrite()).
+class FileStream : public BinaryStream
+{
+public:
+    static const size_t DefaultBufferSize = 1024 * 1024;
+
+    // the file is created or truncated
+    FileStream(const char *path, size_t buffer_size = DefaultBufferSize);
+    ~FileStream();
+    bool isOpened() const;
+    // write buffered data to the file
+    void flush() override;
+    bool failed() const override;
+
+    size_t  tellg() override;
+    void    seekg(size_t pos) override;
+    size_t  read(void *dst, size_t len) override;
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+
+private:
+    size_t writeDirect(const void *data, size_t len, size_t pos);
+
+    intptr_t m_file;    // HANDLE on windows, file descriptor on others. -1 if not opened
+    Buffer m_buf;       // capacity is the buffer size. size is the number of buffered bytes
+    size_t m_buf_pos;   // file position of m_buf[0]
+    size_t m_size;      // file size including buffered data
+    size_t m_wpos;
+    size_t m_rpos;
+    bool m_failed;      // a write to the file failed
+};
+
+
+// file stream that writes into a memory mapped window of the file. the file grows by window_size steps
+// (fallocate() on linux, ftruncate() / SetEndOfFile() on others) and is truncated to the written size when closed.
+// writes and back-patches inside the current window are plain memory stores. the window is remapped when a write
+// goes outside of it.
+class MappedFileStream : public BinaryStream
+{
+public:
+    static const size_t DefaultWindowSize = 64 * 1024 * 1024;
+
+    // the file is created or truncated. window_size is rounded up to the allocation granularity of the OS.
+    MappedFileStream(const char *path, size_t window_size = DefaultWindowSize);
+    ~MappedFileStream();
+    bool isOpened() const;
+    // start writing back dirty pages of the current window
+    void flush() override;
+    bool failed() const override;
+
+    size_t  tellg() override;
+    void    seekg(size_t pos) override;
+    size_t  read(void *dst, size_t len) override;
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+
+private:
+    // map the window that contains pos. return false if failed.
+    bool mapWindow(size_t pos);
+    void unmapWindow();
+    bool growFile(size_t size);
+    // Body: [](char *window_data, size_t len) -> void. called for each window that [pos, pos+len) overlaps.
+    template<class Body> size_t eachWindow(size_t pos, size_t len, const Body& body);
+
+    intptr_t m_file;        // HANDLE on windows, file descriptor on others. -1 if not opened
+    intptr_t m_mapping;     // file mapping object on windows. unused on others
+    char *m_window;
+    size_t m_window_pos;
+    size_t m_window_size;
+    size_t m_capacity;      // actual file size
+    size_t m_size;          // written size
+    size_t m_wpos;
+    size_t m_rpos;
+    bool m_failed;          // the file could not be grown or mapped
+};
+
+
+class fcAsyncWriteBackend;
+
+// file stream that writes in the background. written data is accumulated in blocks and each full block is
+// submitted as an asynchronous write (io_uring on linux, a writer thread on other platforms or if io_uring is unavailable).
+// write() blocks only when the pending (submitted but not completed) bytes exceed max_pending_bytes.
+// completed blocks are recycled for later writes.
+// patches to ranges that are already submitted are issued as separate writes, ordered after the pending ones.
+class AsyncFileStream : public BinaryStream
+{
+public:
+    static const size_t DefaultBlockSize = 1024 * 1024;
+    static const size_t DefaultMaxPendingBytes = 64 * 1024 * 1024;
+
+    // the file is created or truncated. use_io_uring: false to always use the writer thread
+    AsyncFileStream(const char *path, size_t max_pending_bytes = DefaultMaxPendingBytes, size_t block_size = DefaultBlockSize, bool use_io_uring = true);
+    ~AsyncFileStream();
+    bool isOpened() const;
+    bool isUsingIOUring() const;
+    // submit buffered data and block until all writes are completed
+    void flush() override;
+    // writes fail asynchronously. this reports failures of completed writes only, so call flush() first.
+    bool failed() const override;
+
+    size_t  tellg() override;
+    void    seekg(size_t pos) override;
+    size_t  read(void *dst, size_t len) override;
+
+    size_t  tellp() override;
+    void    seekp(size_t pos) override;
+    size_t  write(const void *data, size_t len) override;
+
+private:
+    void submit(Buffer &&buf, size_t pos, bool ordered);
+    void submitBlock();
+    // recycle completed buffers. if wait is true, block until at least one write is completed.
+    void reap(bool wait);
+
+    intptr_t m_file;
+    std::unique_ptr<fcAsyncWriteBackend> m_backend;
+    std::vector<Buffer> m_free_blocks;
+    std::vector<Buffer> m_completed;
+    Buffer m_block;         // tail of the file that is not submitted yet
+    size_t m_block_pos;     // file position of m_block[0]
+    size_t m_block_size;
+    size_t m_max_pending_bytes;
+    size_t m_pending_bytes;
+    int m_num_pending;
+    size_t m_size;
+    size_t m_wpos;
+    size_t m_rpos;
+};
+
+#endif // fcFileStream_h
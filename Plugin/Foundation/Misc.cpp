@@ -5,6 +5,13 @@
     #include <windows.h>
 #else
     #include <dlfcn.h>
+    #include <pthread.h>
+    #include <unistd.h>
+    #include <sys/resource.h>
+    #ifdef fcLinux
+        #include <sched.h>
+        #include <sys/syscall.h>
+    #endif
 #endif
 
 
@@ -129,6 +136,62 @@ double GetCurrentTimeSec()
 #endif
 }
 
+bool SetCurrentThreadName(const char *name)
+{
+#ifdef fcWindows
+    // SetThreadDescription() is available on Windows 10 1607 or later
+    typedef HRESULT (WINAPI *SetThreadDescriptionT)(HANDLE, PCWSTR);
+    static auto s_set_thread_description = (SetThreadDescriptionT)::GetProcAddress(::GetModuleHandleA("kernel32.dll"), "SetThreadDescription");
+    if (!s_set_thread_description) { return false; }
+
+    wchar_t wname[64];
+    if (::MultiByteToWideChar(CP_UTF8, 0, name, -1, wname, _countof(wname)) == 0) { return false; }
+    return SUCCEEDED(s_set_thread_description(::GetCurrentThread(), wname));
+#elif defined(fcMac)
+    return pthread_setname_np(name) == 0;
+#else
+    // linux limits thread names to 15 characters
+    char buf[16];
+    strncpy(buf, name, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    return pthread_setname_np(pthread_self(), buf) == 0;
+#endif
+}
+
+bool SetCurrentThreadAffinity(uint64_t mask)
+{
+#ifdef fcWindows
+    return ::SetThreadAffinityMask(::GetCurrentThread(), (DWORD_PTR)mask) != 0;
+#elif defined(fcLinux)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < 64; ++i) {
+        if (mask & (uint64_t(1) << i)) { CPU_SET(i, &cpus); }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+    // Mac doesn't support thread affinity
+    return false;
+#endif
+}
+
+bool SetCurrentThreadPriority(int priority)
+{
+    priority = std::max<int>(std::min<int>(priority, 2), -2);
+#ifdef fcWindows
+    static const int s_priorities[] = {
+        THREAD_PRIORITY_LOWEST, THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL,
+        THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_HIGHEST,
+    };
+    return ::SetThreadPriority(::GetCurrentThread(), s_priorities[priority + 2]) != 0;
+#elif defined(fcLinux)
+    // nice value is per thread on linux. raising priority (negative nice) requires privilege.
+    return setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), -priority * 5) == 0;
+#else
+    return false;
+#endif
+}
+
 #ifdef fcWindows
 void fcWinPrintLastError()
 {
@@ -23,6 +23,11 @@ void        AlignedFree(void *p);
 
 double      GetCurrentTimeSec();
 
+// apply to the calling thread. return false if not supported or failed.
+bool        SetCurrentThreadName(const char *name);
+bool        SetCurrentThreadAffinity(uint64_t mask);
+bool        SetCurrentThreadPriority(int priority); // -2 (lowest) to 2 (highest)
+
 // execute command and **wait until it ends**
 // return exit-code
 int         Execute(const char *command);
@@ -1,7 +1,19 @@
 #include "pch.h"
 #include "fcFoundation.h"
+#include "fcThreadPool.h"
+#include "ConvertKernelScalar.h"
 
-#define fcEnableISPCKernel
+// ISPC kernels are built for multiple targets (see Foundation.vcxproj) and pick the best one for the CPU at run time.
+// define fcDisableISPCKernel to build without ISPC. the portable kernels in ConvertKernelScalar.h are used then.
+#ifndef fcDisableISPCKernel
+    #define fcEnableISPCKernel
+    #if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+        // the targets in Foundation.vcxproj are all x86. their entry points are also called directly for benchmarks.
+        #define fcEnableISPCTargets
+    #endif
+#endif
+#define fcParallelConvertGrain  (128 * 1024) // pixels per task
+#define fcParallelScaleGrain    (512 * 1024) // elements per task
 
 
 int fcGetPixelSize(fcPixelFormat format)
@@ -53,249 +65,607 @@ void fcImageFlipY(void *image_, int width, int height, fcPixelFormat fmt)
 
 #ifdef fcEnableISPCKernel
 #include "ConvertKernel_ispc.h"
+#ifdef fcEnableISPCTargets
+    // entry points of each target, to run the kernels with a specific instruction set
+    #include "ConvertKernel_ispc_sse2.h"
+    #include "ConvertKernel_ispc_sse4.h"
+    #include "ConvertKernel_ispc_avx.h"
+    #include "ConvertKernel_ispc_avx2.h"
+    #include "ConvertKernel_ispc_avx512skx.h"
+#endif // fcEnableISPCTargets
+
+// Src -> Dst pairs that have ISPC kernels
+#define fcEachISPCKernel(K)\
+    K(RGBAu8, RGBu8)\
+    K(RGBAu8, RGu8)\
+    K(RGBAu8, Ru8)\
+    K(RGBAu8, RGBAf16)\
+    K(RGBAu8, RGBf16)\
+    K(RGBAu8, RGf16)\
+    K(RGBAu8, Rf16)\
+    K(RGBAu8, RGBAf32)\
+    K(RGBAu8, RGBf32)\
+    K(RGBAu8, RGf32)\
+    K(RGBAu8, Rf32)\
+    K(RGBu8, RGBAu8)\
+    K(RGBu8, RGu8)\
+    K(RGBu8, Ru8)\
+    K(RGBu8, RGBAf16)\
+    K(RGBu8, RGBf16)\
+    K(RGBu8, RGf16)\
+    K(RGBu8, Rf16)\
+    K(RGBu8, RGBAf32)\
+    K(RGBu8, RGBf32)\
+    K(RGBu8, RGf32)\
+    K(RGBu8, Rf32)\
+    K(RGu8, RGBAu8)\
+    K(RGu8, RGBu8)\
+    K(RGu8, Ru8)\
+    K(RGu8, RGBAf16)\
+    K(RGu8, RGBf16)\
+    K(RGu8, RGf16)\
+    K(RGu8, Rf16)\
+    K(RGu8, RGBAf32)\
+    K(RGu8, RGBf32)\
+    K(RGu8, RGf32)\
+    K(RGu8, Rf32)\
+    K(Ru8, RGBAu8)\
+    K(Ru8, RGBu8)\
+    K(Ru8, RGu8)\
+    K(Ru8, RGBAf16)\
+    K(Ru8, RGBf16)\
+    K(Ru8, RGf16)\
+    K(Ru8, Rf16)\
+    K(Ru8, RGBAf32)\
+    K(Ru8, RGBf32)\
+    K(Ru8, RGf32)\
+    K(Ru8, Rf32)\
+    K(RGBAf16, RGBAu8)\
+    K(RGBAf16, RGBu8)\
+    K(RGBAf16, RGu8)\
+    K(RGBAf16, Ru8)\
+    K(RGBAf16, RGBAi16)\
+    K(RGBAf16, RGBi16)\
+    K(RGBAf16, RGi16)\
+    K(RGBAf16, Ri16)\
+    K(RGBAf16, RGBf16)\
+    K(RGBAf16, RGf16)\
+    K(RGBAf16, Rf16)\
+    K(RGBAf16, RGBAf32)\
+    K(RGBAf16, RGBf32)\
+    K(RGBAf16, RGf32)\
+    K(RGBAf16, Rf32)\
+    K(RGBf16, RGBAu8)\
+    K(RGBf16, RGBu8)\
+    K(RGBf16, RGu8)\
+    K(RGBf16, Ru8)\
+    K(RGBf16, RGBAi16)\
+    K(RGBf16, RGBi16)\
+    K(RGBf16, RGi16)\
+    K(RGBf16, Ri16)\
+    K(RGBf16, RGBAf16)\
+    K(RGBf16, RGf16)\
+    K(RGBf16, Rf16)\
+    K(RGBf16, RGBAf32)\
+    K(RGBf16, RGBf32)\
+    K(RGBf16, RGf32)\
+    K(RGBf16, Rf32)\
+    K(RGf16, RGBAu8)\
+    K(RGf16, RGBu8)\
+    K(RGf16, RGu8)\
+    K(RGf16, Ru8)\
+    K(RGf16, RGBAi16)\
+    K(RGf16, RGBi16)\
+    K(RGf16, RGi16)\
+    K(RGf16, Ri16)\
+    K(RGf16, RGBAf16)\
+    K(RGf16, RGBf16)\
+    K(RGf16, Rf16)\
+    K(RGf16, RGBAf32)\
+    K(RGf16, RGBf32)\
+    K(RGf16, RGf32)\
+    K(RGf16, Rf32)\
+    K(Rf16, RGBAu8)\
+    K(Rf16, RGBu8)\
+    K(Rf16, RGu8)\
+    K(Rf16, Ru8)\
+    K(Rf16, RGBAi16)\
+    K(Rf16, RGBi16)\
+    K(Rf16, RGi16)\
+    K(Rf16, Ri16)\
+    K(Rf16, RGBAf16)\
+    K(Rf16, RGBf16)\
+    K(Rf16, RGf16)\
+    K(Rf16, RGBAf32)\
+    K(Rf16, RGBf32)\
+    K(Rf16, RGf32)\
+    K(Rf16, Rf32)\
+    K(RGBAf32, RGBAu8)\
+    K(RGBAf32, RGBu8)\
+    K(RGBAf32, RGu8)\
+    K(RGBAf32, Ru8)\
+    K(RGBAf32, RGBAi16)\
+    K(RGBAf32, RGBi16)\
+    K(RGBAf32, RGi16)\
+    K(RGBAf32, Ri16)\
+    K(RGBAf32, RGBAf16)\
+    K(RGBAf32, RGBf16)\
+    K(RGBAf32, RGf16)\
+    K(RGBAf32, Rf16)\
+    K(RGBAf32, RGBf32)\
+    K(RGBAf32, RGf32)\
+    K(RGBAf32, Rf32)\
+    K(RGBf32, RGBAu8)\
+    K(RGBf32, RGBu8)\
+    K(RGBf32, RGu8)\
+    K(RGBf32, Ru8)\
+    K(RGBf32, RGBAi16)\
+    K(RGBf32, RGBi16)\
+    K(RGBf32, RGi16)\
+    K(RGBf32, Ri16)\
+    K(RGBf32, RGBAf16)\
+    K(RGBf32, RGBf16)\
+    K(RGBf32, RGf16)\
+    K(RGBf32, Rf16)\
+    K(RGBf32, RGBAf32)\
+    K(RGBf32, RGf32)\
+    K(RGBf32, Rf32)\
+    K(RGf32, RGBAu8)\
+    K(RGf32, RGBu8)\
+    K(RGf32, RGu8)\
+    K(RGf32, Ru8)\
+    K(RGf32, RGBAi16)\
+    K(RGf32, RGBi16)\
+    K(RGf32, RGi16)\
+    K(RGf32, Ri16)\
+    K(RGf32, RGBAf16)\
+    K(RGf32, RGBf16)\
+    K(RGf32, RGf16)\
+    K(RGf32, Rf16)\
+    K(RGf32, RGBAf32)\
+    K(RGf32, RGBf32)\
+    K(RGf32, Rf32)\
+    K(Rf32, RGBAu8)\
+    K(Rf32, RGBu8)\
+    K(Rf32, RGu8)\
+    K(Rf32, Ru8)\
+    K(Rf32, RGBAi16)\
+    K(Rf32, RGBi16)\
+    K(Rf32, RGi16)\
+    K(Rf32, Ri16)\
+    K(Rf32, RGBAf16)\
+    K(Rf32, RGBf16)\
+    K(Rf32, RGf16)\
+    K(Rf32, Rf16)\
+    K(Rf32, RGBAf32)\
+    K(Rf32, RGBf32)\
+    K(Rf32, RGf32)
+
 
 void fcScaleArray(uint8_t *data, size_t size, float scale)  { ispc::ScaleU8(data, (uint32_t)size, scale); }
 void fcScaleArray(uint16_t *data, size_t size, float scale) { ispc::ScaleI16(data, (uint32_t)size, scale); }
 void fcScaleArray(int32_t *data, size_t size, float scale)  { ispc::ScaleI32(data, (uint32_t)size, scale); }
 void fcScaleArray(half *data, size_t size, float scale)     { ispc::ScaleF16((int16_t*)data, (uint32_t)size, scale); }
 void fcScaleArray(float *data, size_t size, float scale)    { ispc::ScaleF32(data, (uint32_t)size, scale); }
+#else
+void fcScaleArray(uint8_t *data, size_t size, float scale)  { fcScalar::Scale(data, size, scale); }
+void fcScaleArray(uint16_t *data, size_t size, float scale) { fcScalar::Scale(data, size, scale); }
+void fcScaleArray(int32_t *data, size_t size, float scale)  { fcScalar::Scale(data, size, scale); }
+void fcScaleArray(half *data, size_t size, float scale)     { fcScalar::Scale((fcScalar::f16*)data, size, scale); }
+void fcScaleArray(float *data, size_t size, float scale)    { fcScalar::Scale(data, size, scale); }
+#endif // fcEnableISPCKernel
+
 
-const void* fcConvertPixelFormat_ISPC(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size_)
+namespace {
+
+typedef void (*fcConvertKernel)(void *dst, const void *src, size_t size);
+typedef void (*fcConvertImageKernel)(void *dst, int dst_pitch, const void *src, int src_pitch, int width, int height, bool flip_y);
+
+struct fcConvertKernels
 {
-    uint32_t size = (uint32_t)size_;
-    switch (srcfmt) {
-    case fcPixelFormat_RGBAu8:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: return src;
-        case fcPixelFormat_RGBu8: ispc::RGBAu8ToRGBu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGBAu8ToRGu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGBAu8ToRu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGBAu8ToRGBAf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGBAu8ToRGBf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGBAu8ToRGf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGBAu8ToRf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGBAu8ToRGBAf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGBAu8ToRGBf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGBAu8ToRGf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGBAu8ToRf32((float*)dst, (uint8_t*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_RGBu8:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGBu8ToRGBAu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBu8: return src;
-        case fcPixelFormat_RGu8: ispc::RGBu8ToRGu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGBu8ToRu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGBu8ToRGBAf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGBu8ToRGBf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGBu8ToRGf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGBu8ToRf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGBu8ToRGBAf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGBu8ToRGBf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGBu8ToRGf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGBu8ToRf32((float*)dst, (uint8_t*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_RGu8:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGu8ToRGBAu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGu8ToRGBu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGu8: return src;
-        case fcPixelFormat_Ru8: ispc::RGu8ToRu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGu8ToRGBAf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGu8ToRGBf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGu8ToRGf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGu8ToRf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGu8ToRGBAf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGu8ToRGBf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGu8ToRGf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGu8ToRf32((float*)dst, (uint8_t*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_Ru8:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::Ru8ToRGBAu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::Ru8ToRGBu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::Ru8ToRGu8((uint8_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Ru8: return src;
-        case fcPixelFormat_RGBAf16: ispc::Ru8ToRGBAf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::Ru8ToRGBf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::Ru8ToRGf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::Ru8ToRf16((int16_t*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::Ru8ToRGBAf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::Ru8ToRGBf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::Ru8ToRGf32((float*)dst, (uint8_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::Ru8ToRf32((float*)dst, (uint8_t*)src, size); break;
-        }
-        break;
+    fcConvertKernel convert;
+    fcConvertImageKernel convert_image;
+};
 
-    case fcPixelFormat_RGBAf16:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGBAf16ToRGBAu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGBAf16ToRGBu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGBAf16ToRGu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGBAf16ToRu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::RGBAf16ToRGBAi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::RGBAf16ToRGBi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::RGBAf16ToRGi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::RGBAf16ToRi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: return src;
-        case fcPixelFormat_RGBf16: ispc::RGBAf16ToRGBf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGBAf16ToRGf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGBAf16ToRf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGBAf16ToRGBAf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGBAf16ToRGBf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGBAf16ToRGf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGBAf16ToRf32((float*)dst, (int16_t*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_RGBf16:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGBf16ToRGBAu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGBf16ToRGBu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGBf16ToRGu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGBf16ToRu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::RGBf16ToRGBAi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::RGBf16ToRGBi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::RGBf16ToRGi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::RGBf16ToRi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGBf16ToRGBAf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf16: return src;
-        case fcPixelFormat_RGf16: ispc::RGBf16ToRGf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGBf16ToRf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGBf16ToRGBAf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGBf16ToRGBf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGBf16ToRGf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGBf16ToRf32((float*)dst, (int16_t*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_RGf16:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGf16ToRGBAu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGf16ToRGBu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGf16ToRGu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGf16ToRu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::RGf16ToRGBAi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::RGf16ToRGBi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::RGf16ToRGi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::RGf16ToRi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGf16ToRGBAf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGf16ToRGBf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf16: return src;
-        case fcPixelFormat_Rf16: ispc::RGf16ToRf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGf16ToRGBAf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGf16ToRGBf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGf16ToRGf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGf16ToRf32((float*)dst, (int16_t*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_Rf16:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::Rf16ToRGBAu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::Rf16ToRGBu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::Rf16ToRGu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::Rf16ToRu8((uint8_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::Rf16ToRGBAi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::Rf16ToRGBi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::Rf16ToRGi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::Rf16ToRi16((uint16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::Rf16ToRGBAf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::Rf16ToRGBf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::Rf16ToRGf16((int16_t*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf16: return src;
-        case fcPixelFormat_RGBAf32: ispc::Rf16ToRGBAf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::Rf16ToRGBf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::Rf16ToRGf32((float*)dst, (int16_t*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::Rf16ToRf32((float*)dst, (int16_t*)src, size); break;
-        }
-        break;
+template<class DT, class ST, class Size>
+void fcCallKernel(void (*kernel)(DT*, ST*, Size), void *dst, const void *src, size_t size)
+{
+    kernel((DT*)dst, (ST*)src, (Size)size);
+}
 
-    case fcPixelFormat_RGBAf32:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGBAf32ToRGBAu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGBAf32ToRGBu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGBAf32ToRGu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGBAf32ToRu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::RGBAf32ToRGBAi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::RGBAf32ToRGBi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::RGBAf32ToRGi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::RGBAf32ToRi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGBAf32ToRGBAf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGBAf32ToRGBf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGBAf32ToRGf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGBAf32ToRf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf32: return src;
-        case fcPixelFormat_RGBf32: ispc::RGBAf32ToRGBf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::RGBAf32ToRGf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGBAf32ToRf32((float*)dst, (float*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_RGBf32:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGBf32ToRGBAu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGBf32ToRGBu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGBf32ToRGu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGBf32ToRu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::RGBf32ToRGBAi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::RGBf32ToRGBi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::RGBf32ToRGi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::RGBf32ToRi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGBf32ToRGBAf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGBf32ToRGBf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGBf32ToRGf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGBf32ToRf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGBf32ToRGBAf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf32: return src;
-        case fcPixelFormat_RGf32: ispc::RGBf32ToRGf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf32: ispc::RGBf32ToRf32((float*)dst, (float*)src, size); break;
-        }
-        break;
-    case fcPixelFormat_RGf32:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::RGf32ToRGBAu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::RGf32ToRGBu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::RGf32ToRGu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::RGf32ToRu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::RGf32ToRGBAi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::RGf32ToRGBi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::RGf32ToRGi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::RGf32ToRi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::RGf32ToRGBAf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::RGf32ToRGBf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::RGf32ToRGf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::RGf32ToRf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::RGf32ToRGBAf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::RGf32ToRGBf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf32: return src;
-        case fcPixelFormat_Rf32: ispc::RGf32ToRf32((float*)dst, (float*)src, size); break;
+template<class DT, class ST, class Int>
+void fcCallImageKernel(void (*kernel)(DT*, Int, ST*, Int, Int, Int, bool),
+    void *dst, int dst_pitch, const void *src, int src_pitch, int width, int height, bool flip_y)
+{
+    kernel((DT*)dst, (Int)dst_pitch, (ST*)src, (Int)src_pitch, (Int)width, (Int)height, flip_y);
+}
+
+// 5 types (f16, f32, u8, i16, i32) x 1-4 channels
+const int fcNumPixelFormats = 20;
+
+// index in fcConvertKernelTable. -1 if format is not a plain pixel format (unknown, I420, etc)
+int fcGetPixelFormatIndex(fcPixelFormat format)
+{
+    int type = (format & fcPixelFormat_TypeMask) >> 4;
+    int channels = format & fcPixelFormat_ChannelMask;
+    if ((format & ~(fcPixelFormat_TypeMask | fcPixelFormat_ChannelMask)) != 0 ||
+        type < 1 || type > 5 || channels < 1 || channels > 4)
+    {
+        return -1;
+    }
+    return (type - 1) * 4 + (channels - 1);
+}
+
+// Scalar: C++ kernels only. ISPC: ISPC's dispatcher picks the target. the others run a specific ISPC target.
+// the targets are in order of the instruction sets they require.
+enum fcKernelSet
+{
+    fcKernelSet_Scalar,
+    fcKernelSet_SSE2,
+    fcKernelSet_SSE4,
+    fcKernelSet_AVX,
+    fcKernelSet_AVX2,
+    fcKernelSet_AVX512SKX,
+    fcKernelSet_ISPC,
+    fcKernelSet_End,
+};
+
+const char *fcKernelSetNames[fcKernelSet_End] = { "scalar", "sse2", "sse4", "avx", "avx2", "avx512skx", "ispc" };
+
+// kernels for all [dst][src] pairs. the C++ kernels are generated for every pair by templates (ConvertKernelScalar.h),
+// then replaced by the ISPC kernels of the set where there are.
+class fcConvertKernelTable
+{
+public:
+    explicit fcConvertKernelTable(fcKernelSet set)
+    {
+        fcScalar::EachKernel([this](fcPixelFormat dstfmt, fcPixelFormat srcfmt, fcConvertKernel k, fcConvertImageKernel ik) {
+            m_kernels[fcGetPixelFormatIndex(dstfmt)][fcGetPixelFormatIndex(srcfmt)] = { k, ik };
+        });
+#ifdef fcEnableISPCKernel
+        setISPCKernels(set);
+#else
+        (void)set; // no ISPC kernels in this build
+#endif
+    }
+
+    // return nullptr if a format is not convertible
+    const fcConvertKernels* get(fcPixelFormat dstfmt, fcPixelFormat srcfmt) const
+    {
+        int di = fcGetPixelFormatIndex(dstfmt);
+        int si = fcGetPixelFormatIndex(srcfmt);
+        if (di < 0 || si < 0) {
+            fcDebugLog("fcConvertPixelFormat(): can't convert format 0x%x to 0x%x", srcfmt, dstfmt);
+            return nullptr;
         }
-        break;
-    case fcPixelFormat_Rf32:
-        switch (dstfmt) {
-        case fcPixelFormat_RGBAu8: ispc::Rf32ToRGBAu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBu8: ispc::Rf32ToRGBu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGu8: ispc::Rf32ToRGu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ru8: ispc::Rf32ToRu8((uint8_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAi16: ispc::Rf32ToRGBAi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBi16: ispc::Rf32ToRGBi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGi16: ispc::Rf32ToRGi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Ri16: ispc::Rf32ToRi16((uint16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf16: ispc::Rf32ToRGBAf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf16: ispc::Rf32ToRGBf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf16: ispc::Rf32ToRGf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf16: ispc::Rf32ToRf16((int16_t*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBAf32: ispc::Rf32ToRGBAf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGBf32: ispc::Rf32ToRGBf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_RGf32: ispc::Rf32ToRGf32((float*)dst, (float*)src, size); break;
-        case fcPixelFormat_Rf32: return src;
+        return &m_kernels[di][si];
+    }
+
+private:
+#ifdef fcEnableISPCKernel
+    void setISPCKernels(fcKernelSet set)
+    {
+#define fcKernel(Src, Dst, Target)\
+        m_kernels[fcGetPixelFormatIndex(fcPixelFormat_##Dst)][fcGetPixelFormatIndex(fcPixelFormat_##Src)] = {\
+            [](void *dst, const void *src, size_t size) { fcCallKernel(ispc::Src##To##Dst##Target, dst, src, size); },\
+            [](void *dst, int dst_pitch, const void *src, int src_pitch, int width, int height, bool flip_y) {\
+                fcCallImageKernel(ispc::Src##To##Dst##Image##Target, dst, dst_pitch, src, src_pitch, width, height, flip_y);\
+            } };
+#define fcKernelDispatch(Src, Dst)  fcKernel(Src, Dst, )
+#define fcKernelSSE2(Src, Dst)      fcKernel(Src, Dst, _sse2)
+#define fcKernelSSE4(Src, Dst)      fcKernel(Src, Dst, _sse4)
+#define fcKernelAVX(Src, Dst)       fcKernel(Src, Dst, _avx)
+#define fcKernelAVX2(Src, Dst)      fcKernel(Src, Dst, _avx2)
+#define fcKernelAVX512(Src, Dst)    fcKernel(Src, Dst, _avx512skx)
+
+        switch (set) {
+        case fcKernelSet_ISPC:      fcEachISPCKernel(fcKernelDispatch) break;
+#ifdef fcEnableISPCTargets
+        case fcKernelSet_SSE2:      fcEachISPCKernel(fcKernelSSE2) break;
+        case fcKernelSet_SSE4:      fcEachISPCKernel(fcKernelSSE4) break;
+        case fcKernelSet_AVX:       fcEachISPCKernel(fcKernelAVX) break;
+        case fcKernelSet_AVX2:      fcEachISPCKernel(fcKernelAVX2) break;
+        case fcKernelSet_AVX512SKX: fcEachISPCKernel(fcKernelAVX512) break;
+#endif // fcEnableISPCTargets
+        default: break; // scalar
         }
-        break;
+
+#undef fcKernelAVX512
+#undef fcKernelAVX2
+#undef fcKernelAVX
+#undef fcKernelSSE4
+#undef fcKernelSSE2
+#undef fcKernelDispatch
+#undef fcKernel
+    }
+#endif // fcEnableISPCKernel
+
+    fcConvertKernels m_kernels[fcNumPixelFormats][fcNumPixelFormats];
+};
+
+// tables are built on first use
+const fcConvertKernelTable& fcGetConvertKernels(fcKernelSet set)
+{
+#define fcTable(Set) case Set: { static const fcConvertKernelTable s_table(Set); return s_table; }
+    switch (set) {
+    fcTable(fcKernelSet_SSE2)
+    fcTable(fcKernelSet_SSE4)
+    fcTable(fcKernelSet_AVX)
+    fcTable(fcKernelSet_AVX2)
+    fcTable(fcKernelSet_AVX512SKX)
+    fcTable(fcKernelSet_ISPC)
+    default: break;
     }
+#undef fcTable
+    static const fcConvertKernelTable s_scalar(fcKernelSet_Scalar);
+    return s_scalar;
+}
+
+// kernels fcConvertPixelFormat*() use. ISPC if available
+const fcConvertKernelTable& fcGetConvertKernels()
+{
+#ifdef fcEnableISPCKernel
+    return fcGetConvertKernels(fcKernelSet_ISPC);
+#else
+    return fcGetConvertKernels(fcKernelSet_Scalar);
+#endif
+}
+
+const fcConvertKernelTable& fcGetScalarConvertKernels()
+{
+    return fcGetConvertKernels(fcKernelSet_Scalar);
+}
+
+} // namespace
+
+
+const void* fcConvertPixelFormat_Scalar(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size)
+{
+    if (dstfmt == srcfmt) { return src; }
+    auto *kernels = fcGetScalarConvertKernels().get(dstfmt, srcfmt);
+    if (!kernels) { return nullptr; }
+    kernels->convert(dst, src, size);
     return dst;
 }
 
 const void* fcConvertPixelFormat(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size)
 {
-    return fcConvertPixelFormat_ISPC(dst, dstfmt, src, srcfmt, size);
+    if (dstfmt == srcfmt) { return src; }
+    auto *kernels = fcGetConvertKernels().get(dstfmt, srcfmt);
+    if (!kernels) { return nullptr; }
+    kernels->convert(dst, src, size);
+    return dst;
 }
-#endif // fcEnableISPCKernel
+
+void fcConvertPixelFormatImage(void *dst, fcPixelFormat dstfmt, int dst_pitch, const void *src, fcPixelFormat srcfmt, int src_pitch,
+    int width, int height, bool flip_y)
+{
+    if (dst_pitch == 0) { dst_pitch = width * fcGetPixelSize(dstfmt); }
+    if (src_pitch == 0) { src_pitch = width * fcGetPixelSize(srcfmt); }
+
+    if (dstfmt == srcfmt) {
+        // just copy rows
+        size_t row_size = width * fcGetPixelSize(srcfmt);
+        for (int y = 0; y < height; ++y) {
+            int sy = flip_y ? height - 1 - y : y;
+            memcpy((char*)dst + (ptrdiff_t)dst_pitch * y, (const char*)src + (ptrdiff_t)src_pitch * sy, row_size);
+        }
+        return;
+    }
+    auto *kernels = fcGetConvertKernels().get(dstfmt, srcfmt);
+    if (!kernels) { return; }
+    kernels->convert_image(dst, dst_pitch, src, src_pitch, width, height, flip_y);
+}
+
+#ifdef fcEnableISPCTargets
+#ifdef _MSC_VER
+    #include <intrin.h>
+#else
+    #include <cpuid.h>
+#endif
+
+namespace {
+
+void fcCPUID(int leaf, int sub, uint32_t (&regs)[4])
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, sub);
+    for (int i = 0; i < 4; ++i) { regs[i] = (uint32_t)r[i]; }
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+uint64_t fcXGetBV()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+} // namespace
+
+// same checks as ISPC's own dispatcher does, to tell which of the targets is running
+static fcKernelSet fcDetectISPCTarget()
+{
+    uint32_t r1[4], r7[4] = {};
+    fcCPUID(0, 0, r1);
+    uint32_t max_leaf = r1[0];
+    fcCPUID(1, 0, r1);
+    if (max_leaf >= 7) { fcCPUID(7, 0, r7); }
+
+    bool sse2 = (r1[3] & (1 << 26)) != 0;
+    bool sse42 = (r1[2] & (1 << 20)) != 0;
+    bool osxsave = (r1[2] & (1 << 27)) != 0;
+    uint64_t xcr0 = osxsave ? fcXGetBV() : 0;
+    bool avx = (r1[2] & (1 << 28)) != 0 && (xcr0 & 0x6) == 0x6;
+    bool avx2 = avx && (r7[1] & (1 << 5)) != 0 && (r1[2] & (1 << 29)) != 0 /* f16c */ && (r1[2] & (1 << 12)) != 0 /* fma */;
+    bool avx512skx = avx2 && (xcr0 & 0xe6) == 0xe6 &&
+        (r7[1] & (1 << 16)) && (r7[1] & (1 << 17)) && (r7[1] & (1 << 28)) && (r7[1] & (1 << 30)) && (r7[1] & (1u << 31)); // F, DQ, CD, BW, VL
+
+    if (avx512skx) { return fcKernelSet_AVX512SKX; }
+    if (avx2) { return fcKernelSet_AVX2; }
+    if (avx) { return fcKernelSet_AVX; }
+    if (sse42) { return fcKernelSet_SSE4; }
+    if (sse2) { return fcKernelSet_SSE2; }
+    return fcKernelSet_Scalar;
+}
+#endif // fcEnableISPCTargets
+
+// kernel sets fcConvertPixelFormat_ISA() can run on this CPU: scalar, then each ISPC target up to the one the dispatcher picks
+static const std::vector<fcKernelSet>& fcGetKernelSets()
+{
+    static const std::vector<fcKernelSet> s_sets = []() {
+        std::vector<fcKernelSet> sets = { fcKernelSet_Scalar };
+#if defined(fcEnableISPCTargets)
+        fcKernelSet best = fcDetectISPCTarget();
+        for (int i = fcKernelSet_SSE2; i <= best; ++i) { sets.push_back((fcKernelSet)i); }
+#elif defined(fcEnableISPCKernel)
+        sets.push_back(fcKernelSet_ISPC);
+#endif
+        return sets;
+    }();
+    return s_sets;
+}
+
+const char* fcGetConvertKernelTarget()
+{
+    return fcKernelSetNames[fcGetKernelSets().back()];
+}
+
+int fcGetNumConvertKernelISAs()
+{
+    return (int)fcGetKernelSets().size();
+}
+
+const char* fcGetConvertKernelISAName(int isa)
+{
+    auto &sets = fcGetKernelSets();
+    return isa >= 0 && isa < (int)sets.size() ? fcKernelSetNames[sets[isa]] : nullptr;
+}
+
+const void* fcConvertPixelFormat_ISA(int isa, void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size)
+{
+    auto &sets = fcGetKernelSets();
+    if (isa < 0 || isa >= (int)sets.size()) { return nullptr; }
+    if (dstfmt == srcfmt) { return src; }
+    auto *kernels = fcGetConvertKernels(sets[isa]).get(dstfmt, srcfmt);
+    if (!kernels) { return nullptr; }
+    kernels->convert(dst, src, size);
+    return dst;
+}
+
+// Kernel: ISPC kernel name. Scalar: the C++ kernel call for fcKernelSet_Scalar
+#ifdef fcEnableISPCTargets
+    #define fcScaleTargets(Kernel, Data)\
+        case fcKernelSet_SSE2:      ispc::Kernel##_sse2(Data, (uint32_t)size, scale); break;\
+        case fcKernelSet_SSE4:      ispc::Kernel##_sse4(Data, (uint32_t)size, scale); break;\
+        case fcKernelSet_AVX:       ispc::Kernel##_avx(Data, (uint32_t)size, scale); break;\
+        case fcKernelSet_AVX2:      ispc::Kernel##_avx2(Data, (uint32_t)size, scale); break;\
+        case fcKernelSet_AVX512SKX: ispc::Kernel##_avx512skx(Data, (uint32_t)size, scale); break;
+#else
+    #define fcScaleTargets(Kernel, Data)
+#endif
+#define fcScaleISA(Kernel, Data, Scalar)\
+    auto &sets = fcGetKernelSets();\
+    if (isa < 0 || isa >= (int)sets.size()) { return false; }\
+    switch (sets[isa]) {\
+    fcScaleTargets(Kernel, Data)\
+    case fcKernelSet_ISPC: fcScaleArray(data, size, scale); break;\
+    default: Scalar; break;\
+    }\
+    return true;
+
+bool fcScaleArray_ISA(int isa, uint8_t *data, size_t size, float scale)  { fcScaleISA(ScaleU8, data, fcScalar::Scale(data, size, scale)) }
+bool fcScaleArray_ISA(int isa, uint16_t *data, size_t size, float scale) { fcScaleISA(ScaleI16, data, fcScalar::Scale(data, size, scale)) }
+bool fcScaleArray_ISA(int isa, int32_t *data, size_t size, float scale)  { fcScaleISA(ScaleI32, data, fcScalar::Scale(data, size, scale)) }
+bool fcScaleArray_ISA(int isa, half *data, size_t size, float scale)     { fcScaleISA(ScaleF16, (int16_t*)data, fcScalar::Scale((fcScalar::f16*)data, size, scale)) }
+bool fcScaleArray_ISA(int isa, float *data, size_t size, float scale)    { fcScaleISA(ScaleF32, data, fcScalar::Scale(data, size, scale)) }
+#undef fcScaleISA
+#undef fcScaleTargets
+
+
+const void* fcConvertPixelFormatParallel(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size)
+{
+    if (dstfmt == srcfmt) { return src; }
+    if (!fcGetConvertKernels().get(dstfmt, srcfmt)) { return nullptr; }
+
+    size_t dst_psize = fcGetPixelSize(dstfmt);
+    size_t src_psize = fcGetPixelSize(srcfmt);
+    fcParallelFor(size, fcParallelConvertGrain, [&](size_t begin, size_t end) {
+        fcConvertPixelFormat((char*)dst + dst_psize * begin, dstfmt, (const char*)src + src_psize * begin, srcfmt, end - begin);
+    });
+    return dst;
+}
+
+void fcConvertPixelFormatImageParallel(void *dst, fcPixelFormat dstfmt, int dst_pitch, const void *src, fcPixelFormat srcfmt, int src_pitch,
+    int width, int height, bool flip_y)
+{
+    if (!fcGetConvertKernels().get(dstfmt, srcfmt)) { return; }
+    if (dst_pitch == 0) { dst_pitch = width * fcGetPixelSize(dstfmt); }
+    if (src_pitch == 0) { src_pitch = width * fcGetPixelSize(srcfmt); }
+
+    size_t grain_rows = std::max<size_t>(fcParallelConvertGrain / std::max<size_t>(width, 1), 1);
+    fcParallelFor(height, grain_rows, [&](size_t begin, size_t end) {
+        // if flip_y, dst rows [begin, end) come from src rows [height - end, height - begin)
+        size_t src_begin = flip_y ? height - end : begin;
+        fcConvertPixelFormatImage(
+            (char*)dst + (ptrdiff_t)dst_pitch * begin, dstfmt, dst_pitch,
+            (const char*)src + (ptrdiff_t)src_pitch * src_begin, srcfmt, src_pitch,
+            width, int(end - begin), flip_y);
+    });
+}
+
+void fcKickConvertPixelFormat(fcJob *job, void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size)
+{
+    if (!fcGetConvertKernels().get(dstfmt, srcfmt)) {
+        if (job) { job->complete(false); }
+        return;
+    }
+    size_t dst_psize = fcGetPixelSize(dstfmt);
+    size_t src_psize = fcGetPixelSize(srcfmt);
+
+    // the job is referenced until the last band is converted
+    if (job) { job->addRef(); }
+    fcParallelForAsync(size, fcParallelConvertGrain,
+        [=](size_t begin, size_t end) {
+            char *d = (char*)dst + dst_psize * begin;
+            const char *s = (const char*)src + src_psize * begin;
+            if (dstfmt == srcfmt) {
+                memcpy(d, s, dst_psize * (end - begin));
+            }
+            else {
+                fcConvertPixelFormat(d, dstfmt, s, srcfmt, end - begin);
+            }
+        },
+        [job]() {
+            if (job) {
+                job->complete(true);
+                job->release();
+            }
+        });
+}
+
+template<class T>
+static inline void fcScaleArrayParallelImpl(T *data, size_t size, float scale)
+{
+    fcParallelFor(size, fcParallelScaleGrain, [&](size_t begin, size_t end) {
+        fcScaleArray(data + begin, end - begin, scale);
+    });
+}
+void fcScaleArrayParallel(uint8_t *data, size_t size, float scale)  { fcScaleArrayParallelImpl(data, size, scale); }
+void fcScaleArrayParallel(uint16_t *data, size_t size, float scale) { fcScaleArrayParallelImpl(data, size, scale); }
+void fcScaleArrayParallel(int32_t *data, size_t size, float scale)  { fcScaleArrayParallelImpl(data, size, scale); }
+void fcScaleArrayParallel(half *data, size_t size, float scale)
+{
+    // half is incomplete here. step by its size (2 bytes)
+    fcParallelFor(size, fcParallelScaleGrain, [&](size_t begin, size_t end) {
+        fcScaleArray((half*)((uint16_t*)data + begin), end - begin, scale);
+    });
+}
+void fcScaleArrayParallel(float *data, size_t size, float scale)    { fcScaleArrayParallelImpl(data, size, scale); }
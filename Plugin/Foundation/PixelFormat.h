@@ -12,6 +12,43 @@ void fcScaleArray(uint16_t *data, size_t size, float scale);
 void fcScaleArray(int32_t *data, size_t size, float scale);
 void fcScaleArray(half *data, size_t size, float scale);
 void fcScaleArray(float *data, size_t size, float scale);
+// any pair of the u8 / i16 / i32 / f16 / f32 formats can be converted. return src if the formats are same,
+// and nullptr if a format is not convertible (unknown, I420).
 const void* fcConvertPixelFormat(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+// portable C++ kernels. same results as fcConvertPixelFormat() (f16 may differ in rounding). for tests and benchmarks.
+const void* fcConvertPixelFormat_Scalar(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+// instruction set the conversion kernels run with on this CPU: "avx512skx", "avx2", "avx", "sse4", "sse2" or "scalar".
+const char* fcGetConvertKernelTarget();
+// instruction sets the kernels can be run with on this CPU, for benchmarks: 0 is "scalar", then each ISPC target it supports
+// in order, up to fcGetConvertKernelTarget(). fcConvertPixelFormat_ISA() returns nullptr if isa is out of range.
+int fcGetNumConvertKernelISAs();
+const char* fcGetConvertKernelISAName(int isa);
+const void* fcConvertPixelFormat_ISA(int isa, void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+// fcScaleArray() with the kernels of isa. return false if isa is out of range.
+bool fcScaleArray_ISA(int isa, uint8_t *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, uint16_t *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, int32_t *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, half *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, float *data, size_t size, float scale);
+// convert, flip vertically (if flip_y) and re-pitch an image in one pass. dst is always written, even if the formats are same.
+// pitches are in bytes. 0 means tightly packed (width * pixel size). src and dst must not overlap.
+void fcConvertPixelFormatImage(void *dst, fcPixelFormat dstfmt, int dst_pitch, const void *src, fcPixelFormat srcfmt, int src_pitch,
+    int width, int height, bool flip_y);
+
+// same as above, but large images are split into bands converted on fcThreadPool.
+// the calling thread converts bands too and returns when all are done.
+void fcScaleArrayParallel(uint8_t *data, size_t size, float scale);
+void fcScaleArrayParallel(uint16_t *data, size_t size, float scale);
+void fcScaleArrayParallel(int32_t *data, size_t size, float scale);
+void fcScaleArrayParallel(half *data, size_t size, float scale);
+void fcScaleArrayParallel(float *data, size_t size, float scale);
+const void* fcConvertPixelFormatParallel(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+void fcConvertPixelFormatImageParallel(void *dst, fcPixelFormat dstfmt, int dst_pitch, const void *src, fcPixelFormat srcfmt, int src_pitch,
+    int width, int height, bool flip_y);
+
+// start converting on fcThreadPool and return immediately. job (can be null) is completed when all bands are converted.
+// dst is always written, even if the formats are same. src and dst must be kept alive until then.
+class fcJob;
+void fcKickConvertPixelFormat(fcJob *job, void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
 
 #endif // PixelFormat
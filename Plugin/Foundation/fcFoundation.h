@@ -6,6 +6,7 @@ typedef BinaryStream fcStream;
 
 #include "Misc.h"
 #include "Buffer.h"
+#include "FileStream.h"
 #include "PixelFormat.h"
 #include "FrameCapturer.h"
 
@@ -1,46 +1,334 @@
 ﻿#include "pch.h"
+#include "fcFoundation.h"
 #include "fcThreadPool.h"
 
+namespace {
+    std::mutex g_worker_config_mutex;
+    fcThreadPoolConfig g_worker_config;
+    std::string g_worker_name_prefix;
+    bool g_worker_config_frozen = false;
+}
+
+bool fcSetWorkerThreadConfig(const fcThreadPoolConfig &conf)
+{
+    std::unique_lock<std::mutex> lock(g_worker_config_mutex);
+    if (g_worker_config_frozen) {
+        fcDebugLog("fcSetWorkerThreadConfig(): worker threads are already running.");
+        return false;
+    }
+
+    g_worker_config = conf;
+    if (conf.name_prefix) {
+        // caller's string may not outlive the config
+        g_worker_name_prefix = conf.name_prefix;
+        g_worker_config.name_prefix = g_worker_name_prefix.c_str();
+    }
+    return true;
+}
+
+const fcThreadPoolConfig& fcGetWorkerThreadConfig()
+{
+    std::unique_lock<std::mutex> lock(g_worker_config_mutex);
+    g_worker_config_frozen = true;
+    return g_worker_config;
+}
+
+void fcApplyWorkerThreadConfig(const char *name)
+{
+    const auto& conf = fcGetWorkerThreadConfig();
+    if (conf.affinity_mask != 0) {
+        SetCurrentThreadAffinity(conf.affinity_mask);
+    }
+    if (conf.priority != 0) {
+        SetCurrentThreadPriority(conf.priority);
+    }
+    if (conf.name_prefix) {
+        SetCurrentThreadName((std::string(conf.name_prefix) + name).c_str());
+    }
+}
+
+// split modules (FrameCapturer_PNG etc.) have their own thread pool. FrameCapturer passes its config via this.
+fcCLinkage fcExport bool fcSetThreadPoolConfigImpl(const fcThreadPoolConfig *conf)
+{
+    return conf ? fcSetWorkerThreadConfig(*conf) : false;
+}
+
+
+fcTaskRing::fcTaskRing()
+    : m_tasks(16)
+    , m_head(0)
+    , m_size(0)
+{
+}
+
+void fcTaskRing::push_back(fcTask &&task)
+{
+    if (m_size == m_tasks.size()) { grow(); }
+    m_tasks[(m_head + m_size) & (m_tasks.size() - 1)] = std::move(task);
+    ++m_size;
+}
+
+fcTask fcTaskRing::pop_front()
+{
+    fcTask ret = std::move(m_tasks[m_head]);
+    m_head = (m_head + 1) & (m_tasks.size() - 1);
+    --m_size;
+    return ret;
+}
+
+fcTask fcTaskRing::pop_back()
+{
+    --m_size;
+    return std::move(m_tasks[(m_head + m_size) & (m_tasks.size() - 1)]);
+}
+
+void fcTaskRing::grow()
+{
+    std::vector<fcTask> tasks(m_tasks.size() * 2);
+    for (size_t i = 0; i < m_size; ++i) {
+        tasks[i] = std::move(m_tasks[(m_head + i) & (m_tasks.size() - 1)]);
+    }
+    m_tasks.swap(tasks);
+    m_head = 0;
+}
+
+
+fcSemaphore::fcSemaphore(int count)
+    : m_count(count)
+{
+}
+
+void fcSemaphore::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_count <= 0) {
+        m_condition.wait(lock);
+    }
+    --m_count;
+}
+
+bool fcSemaphore::tryAcquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_count <= 0) { return false; }
+    --m_count;
+    return true;
+}
+
+void fcSemaphore::release()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_count;
+    }
+    m_condition.notify_one();
+}
+
+int fcSemaphore::getCount() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_count;
+}
+
+
+fcJob::fcJob(fcJobCallback_t cb, void *userdata)
+    : m_ref(1)
+    , m_state(fcJobState_Pending)
+    , m_callback(cb)
+    , m_userdata(userdata)
+{
+}
+
+fcJob::~fcJob()
+{
+}
+
+void fcJob::addRef()
+{
+    ++m_ref;
+}
+
+void fcJob::release()
+{
+    if (--m_ref == 0) {
+        delete this;
+    }
+}
+
+fcJobState fcJob::poll()
+{
+    return (fcJobState)m_state.load();
+}
+
+fcJobState fcJob::wait(int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto finished = [this]() { return m_state != fcJobState_Pending; };
+    if (timeout_ms < 0) {
+        m_condition.wait(lock, finished);
+    }
+    else {
+        m_condition.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished);
+    }
+    return (fcJobState)m_state.load();
+}
+
+void fcJob::complete(bool succeeded)
+{
+    fcJobState state = succeeded ? fcJobState_Succeeded : fcJobState_Failed;
+    // callback first, so that it has returned when poll() / wait() report the result
+    if (m_callback) {
+        m_callback(this, state, m_userdata);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_state = state;
+    }
+    m_condition.notify_all();
+}
+
+
+fcIndexFreeList::fcIndexFreeList()
+    : m_head(0)
+    , m_num_waiting(0)
+{
+}
+
+void fcIndexFreeList::reset(int capacity)
+{
+    m_next.reset(new std::atomic<uint32_t>[capacity]);
+    for (int i = 0; i < capacity; ++i) {
+        m_next[i] = i + 1 < capacity ? uint32_t(i + 2) : 0;
+    }
+    m_head = capacity > 0 ? 1 : 0;
+}
+
+int fcIndexFreeList::tryPop()
+{
+    uint64_t head = m_head;
+    for (;;) {
+        uint32_t top = uint32_t(head);
+        if (top == 0) { return -1; }
+
+        uint64_t next = ((head >> 32) + 1) << 32 | m_next[top - 1];
+        if (m_head.compare_exchange_weak(head, next)) {
+            return int(top - 1);
+        }
+    }
+}
+
+int fcIndexFreeList::pop()
+{
+    int ret = tryPop();
+    if (ret >= 0) { return ret; }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_num_waiting;
+    while ((ret = tryPop()) < 0) {
+        m_condition.wait(lock);
+    }
+    --m_num_waiting;
+    return ret;
+}
+
+void fcIndexFreeList::push(int index)
+{
+    uint64_t head = m_head;
+    for (;;) {
+        m_next[index] = uint32_t(head);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | uint32_t(index + 1);
+        if (m_head.compare_exchange_weak(head, new_head)) {
+            break;
+        }
+    }
+
+    // same as fcThreadPool::enqueue(): the waiter counts itself before retrying, so checking the count after the push never misses it
+    if (m_num_waiting > 0) {
+        { std::unique_lock<std::mutex> lock(m_mutex); }
+        m_condition.notify_one();
+    }
+}
+
+
 #ifndef fcWithTBB
 
+namespace {
+    const int fcMaxRealtimeStreak = 16;
+
+    thread_local const fcThreadPool *g_worker_pool = nullptr;
+    thread_local int g_worker_index = -1;
+}
+
 class fcWorkerThread
 {
 public:
+    fcWorkerThread(fcThreadPool &pool, int index) : m_pool(pool), m_index(index) {}
     void operator()();
+
+private:
+    fcThreadPool &m_pool;
+    int m_index;
 };
 
 
 void fcWorkerThread::operator()()
 {
-    fcThreadPool &pool = fcThreadPool::getInstance();
-    std::function<void()> task;
-    while (true)
+    g_worker_pool = &m_pool;
+    g_worker_index = m_index;
+    fcApplyWorkerThreadConfig(("Worker" + std::to_string(m_index)).c_str());
+
+    fcTask task;
+    fcTaskPriority priority;
+    int realtime_streak = 0;
+    for (;;)
     {
-        {
-            std::unique_lock<std::mutex> lock(pool.m_queue_mutex);
-            while (!pool.m_stop && pool.m_tasks.empty()) {
-                pool.m_condition.wait(lock);
+        if (m_pool.popTask(task, priority, m_index, realtime_streak >= fcMaxRealtimeStreak)) {
+            // only count realtime tasks that actually kept background tasks waiting
+            if (priority == fcTaskPriority_Realtime && m_pool.m_num_tasks[fcTaskPriority_Background] > 0) {
+                ++realtime_streak;
+            }
+            else {
+                realtime_streak = 0;
             }
-            if (pool.m_stop) { return; }
 
-            task = pool.m_tasks.front();
-            pool.m_tasks.pop_front();
+            task();
+            task.reset();
+            if (priority == fcTaskPriority_Background) {
+                m_pool.endBackgroundTask();
+            }
+        }
+        else if (!m_pool.waitTasks()) {
+            break;
         }
-        task();
     }
 }
 
 fcThreadPool::fcThreadPool(size_t threads)
-    : m_stop(false)
+    : m_num_running_background(0)
+    , m_num_sleeping(0)
+    , m_next_queue(0)
+    , m_stop(false)
 {
+    threads = std::max<size_t>(threads, 1);
+    for (auto& n : m_num_tasks) { n = 0; }
+    // keep one worker free for realtime tasks
+    m_max_running_background = std::max<int>(int(threads) - 1, 1);
+
+    for (size_t i = 0; i < threads; ++i) {
+        m_queues.emplace_back(new TaskQueue());
+    }
     for (size_t i = 0; i < threads; ++i) {
-        m_workers.push_back(std::thread(fcWorkerThread()));
+        m_workers.push_back(std::thread(fcWorkerThread(*this, (int)i)));
     }
 }
 
 fcThreadPool::~fcThreadPool()
 {
-    m_stop = true;
+    {
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
     m_condition.notify_all();
 
     for (auto& worker : m_workers) {
@@ -50,46 +338,266 @@ fcThreadPool::~fcThreadPool()
 
 fcThreadPool& fcThreadPool::getInstance()
 {
-    static fcThreadPool s_instance(std::thread::hardware_concurrency());
+    static fcThreadPool s_instance([]() {
+        int n = fcGetWorkerThreadConfig().num_workers;
+        return n > 0 ? size_t(n) : size_t(std::thread::hardware_concurrency());
+    }());
     return s_instance;
 }
 
-void fcThreadPool::enqueue(const std::function<void()> &f)
+size_t fcThreadPool::getNumWorkers() const
+{
+    return m_workers.size();
+}
+
+size_t fcGetNumWorkerThreads()
+{
+    return fcThreadPool::getInstance().getNumWorkers();
+}
+
+int fcThreadPool::getCurrentWorkerIndex() const
 {
+    return g_worker_pool == this ? g_worker_index : -1;
+}
+
+void fcThreadPool::enqueue(fcTask &&task, fcTaskPriority priority)
+{
+    // nested tasks go to the local queue. others are distributed round-robin.
+    int qi = getCurrentWorkerIndex();
+    if (qi < 0) {
+        qi = int(m_next_queue++ % m_queues.size());
+    }
+
+    // count first so that sleeping workers never miss this task
+    ++m_num_tasks[priority];
     {
-        std::unique_lock<std::mutex> lock(m_queue_mutex);
-        m_tasks.push_back(std::function<void()>(f));
+        auto& q = *m_queues[qi];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        q.tasks[priority].push_back(std::move(task));
     }
-    m_condition.notify_one();
+    if (m_num_sleeping > 0) {
+        { std::unique_lock<std::mutex> lock(m_sleep_mutex); }
+        m_condition.notify_one();
+    }
+}
+
+bool fcThreadPool::popTask(fcTask &dst, fcTaskPriority &dst_priority, int worker_index, bool prefer_background)
+{
+    static const fcTaskPriority s_order[2][fcTaskPriority_Count] = {
+        { fcTaskPriority_Realtime, fcTaskPriority_Background },
+        { fcTaskPriority_Background, fcTaskPriority_Realtime },
+    };
+    for (auto priority : s_order[prefer_background ? 1 : 0]) {
+        if (popTaskFromLane(dst, priority, worker_index)) {
+            dst_priority = priority;
+            return true;
+        }
+    }
+    return false;
 }
 
+bool fcThreadPool::popTaskFromLane(fcTask &dst, fcTaskPriority priority, int worker_index)
+{
+    auto& num_tasks = m_num_tasks[priority];
+    if (num_tasks <= 0) { return false; }
+
+    bool background = priority == fcTaskPriority_Background;
+    if (background) {
+        // reserve a background slot before taking the task
+        if (++m_num_running_background > m_max_running_background) {
+            endBackgroundTask();
+            return false;
+        }
+    }
+
+    // local queue: newest first
+    if (worker_index >= 0) {
+        auto& q = *m_queues[worker_index];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        auto& tasks = q.tasks[priority];
+        if (!tasks.empty()) {
+            dst = tasks.pop_back();
+            --num_tasks;
+            return true;
+        }
+    }
 
+    // steal: oldest first
+    size_t n = m_queues.size();
+    size_t begin = worker_index >= 0 ? size_t(worker_index) + 1 : size_t(m_next_queue);
+    for (size_t i = 0; i < n; ++i) {
+        size_t qi = (begin + i) % n;
+        if (int(qi) == worker_index) { continue; }
+
+        auto& q = *m_queues[qi];
+        std::unique_lock<std::mutex> lock(q.mutex);
+        auto& tasks = q.tasks[priority];
+        if (!tasks.empty()) {
+            dst = tasks.pop_front();
+            --num_tasks;
+            return true;
+        }
+    }
+
+    if (background) {
+        endBackgroundTask();
+    }
+    return false;
+}
+
+void fcThreadPool::endBackgroundTask()
+{
+    // a background slot is freed. wake a worker if background tasks are waiting for it.
+    --m_num_running_background;
+    if (m_num_tasks[fcTaskPriority_Background] > 0 && m_num_sleeping > 0) {
+        { std::unique_lock<std::mutex> lock(m_sleep_mutex); }
+        m_condition.notify_one();
+    }
+}
+
+bool fcThreadPool::hasRunnableTasks() const
+{
+    return m_num_tasks[fcTaskPriority_Realtime] > 0 ||
+        (m_num_tasks[fcTaskPriority_Background] > 0 && m_num_running_background < m_max_running_background);
+}
+
+bool fcThreadPool::waitTasks()
+{
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    ++m_num_sleeping;
+    while (!m_stop && !hasRunnableTasks()) {
+        m_condition.wait(lock);
+    }
+    --m_num_sleeping;
+    return !m_stop;
+}
+
+
+
+void fcEnqueueTask(fcTask &&task, fcTaskPriority priority)
+{
+    fcThreadPool::getInstance().enqueue(std::move(task), priority);
+}
+
+
+struct fcTaskGroup::StatePool
+{
+    std::mutex mutex;
+    std::vector<State*> free;
+
+    ~StatePool() { for (State *s : free) { delete s; } }
+};
+
+fcTaskGroup::StatePool& fcTaskGroup::getStatePool()
+{
+    static StatePool s_pool;
+    return s_pool;
+}
+
+fcTaskGroup::State* fcTaskGroup::acquireState()
+{
+    State *ret = nullptr;
+    {
+        auto& pool = getStatePool();
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        if (!pool.free.empty()) {
+            ret = pool.free.back();
+            pool.free.pop_back();
+        }
+    }
+    if (!ret) { ret = new State(); }
+    ret->ref = 1;
+    return ret;
+}
+
+void fcTaskGroup::releaseState(State *state)
+{
+    // the last reference. all tasks have been run, so the rings are empty
+    if (--state->ref == 0) {
+        auto& pool = getStatePool();
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        pool.free.push_back(state);
+    }
+}
 
 fcTaskGroup::fcTaskGroup()
-    : m_active_tasks(0)
+    : m_state(acquireState())
 {
 }
 
 fcTaskGroup::~fcTaskGroup()
 {
+    releaseState(m_state);
 }
 
-void fcTaskGroup::wait()
+void fcTaskGroup::runImpl(fcTask &&task, fcTaskPriority priority)
 {
-    fcThreadPool &pool = fcThreadPool::getInstance();
-    while (m_active_tasks > 0)
     {
-        std::function<void()> task;
-        {
-            std::unique_lock<std::mutex> lock(pool.m_queue_mutex);
-            if (!pool.m_tasks.empty()) {
-                task = pool.m_tasks.front();
-                pool.m_tasks.pop_front();
-            }
-        }
-        if (task) { task(); }
-        else { std::this_thread::yield(); }
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        ++m_state->active_tasks;
+        m_state->tasks[priority].push_back(std::move(task));
+    }
+
+    // each pool task runs one pending task of this group with the same priority, if wait() has not already taken it
+    State *state = m_state;
+    ++state->ref;
+    fcThreadPool::getInstance().enqueue([state, priority]() {
+        runOne(*state, priority);
+        releaseState(state);
+    }, priority);
+}
+
+bool fcTaskGroup::runOne(State &state, fcTaskPriority priority)
+{
+    fcTask task;
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        auto& tasks = state.tasks[priority];
+        if (tasks.empty()) { return false; }
+        task = tasks.pop_front();
+    }
+
+    task();
+    if (--state.active_tasks == 0) {
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.condition.notify_all();
     }
+    return true;
+}
+
+void fcTaskGroup::wait()
+{
+    State &state = *m_state;
+    while (runOne(state, fcTaskPriority_Realtime) || runOne(state, fcTaskPriority_Background)) {}
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    while (state.active_tasks > 0) {
+        state.condition.wait(lock);
+    }
+}
+
+bool fcTaskGroup::wait_for(int timeout_ms)
+{
+    State &state = *m_state;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    return state.condition.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&state]() {
+        return state.active_tasks <= 0;
+    });
+}
+
+#else // fcWithTBB
+
+void fcEnqueueTask(fcTask &&task, fcTaskPriority)
+{
+    // tbb copies functors
+    auto shared = std::make_shared<fcTask>(std::move(task));
+    tbb::task_arena arena{ tbb::task_arena::attach() }; // braces: not a function declaration
+    arena.enqueue([shared]() { (*shared)(); });
+}
+
+size_t fcGetNumWorkerThreads()
+{
+    return size_t(tbb::this_task_arena::max_concurrency());
 }
 
 #endif // fcWithTBB
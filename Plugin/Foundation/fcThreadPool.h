@@ -1,38 +1,333 @@
 ﻿#ifndef fcThreadPool_h
 #define fcThreadPool_h
 
-#ifndef fcWithTBB
+// settings of worker threads (see fcSetThreadPoolConfig()).
+// the config is frozen when it is first read, that is, when the pool or an encoder thread starts.
+bool fcSetWorkerThreadConfig(const fcThreadPoolConfig &conf); // return false if already frozen
+const fcThreadPoolConfig& fcGetWorkerThreadConfig();
+// apply affinity, priority and name ("<name_prefix><name>") of the config to the calling thread.
+void fcApplyWorkerThreadConfig(const char *name);
 
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
 #include <vector>
-#include <deque>
-#include <thread>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <cstdint>
+
+// move-only task. callables that fit in InlineSize are stored in place, so constructing and moving tasks
+// doesn't allocate. larger callables fall back to the heap.
+class fcTask
+{
+public:
+    static const size_t InlineSize = 48;
+
+    fcTask() : m_vtable(nullptr) {}
+    template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, fcTask>::value>::type>
+    fcTask(F &&f) : m_vtable(nullptr) { assign(std::forward<F>(f)); }
+    fcTask(fcTask &&v) noexcept : m_vtable(nullptr) { moveFrom(v); }
+    fcTask& operator=(fcTask &&v) noexcept
+    {
+        if (this != &v) { reset(); moveFrom(v); }
+        return *this;
+    }
+    fcTask(const fcTask&) = delete;
+    fcTask& operator=(const fcTask&) = delete;
+    ~fcTask() { reset(); }
+
+    void operator()() { m_vtable->invoke(m_storage); }
+    explicit operator bool() const { return m_vtable != nullptr; }
+    void reset()
+    {
+        if (m_vtable) {
+            m_vtable->destroy(m_storage);
+            m_vtable = nullptr;
+        }
+    }
+
+private:
+    struct VTable
+    {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src); // move src to dst and destroy src
+        void (*destroy)(void *storage);
+    };
+
+    template<class F>
+    struct InlineImpl
+    {
+        static void invoke(void *s) { (*(F*)s)(); }
+        static void move(void *d, void *s) { new (d) F(std::move(*(F*)s)); ((F*)s)->~F(); }
+        static void destroy(void *s) { ((F*)s)->~F(); }
+        static const VTable s_vtable;
+    };
+
+    template<class F>
+    struct HeapImpl
+    {
+        static void invoke(void *s) { (**(F**)s)(); }
+        static void move(void *d, void *s) { *(F**)d = *(F**)s; }
+        static void destroy(void *s) { delete *(F**)s; }
+        static const VTable s_vtable;
+    };
+
+    template<class F>
+    void assign(F &&f)
+    {
+        typedef typename std::decay<F>::type T;
+        if (sizeof(T) <= InlineSize && alignof(T) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible<T>::value) {
+            new (m_storage) T(std::forward<F>(f));
+            m_vtable = &InlineImpl<T>::s_vtable;
+        }
+        else {
+            *(T**)m_storage = new T(std::forward<F>(f));
+            m_vtable = &HeapImpl<T>::s_vtable;
+        }
+    }
+
+    void moveFrom(fcTask &v)
+    {
+        if (v.m_vtable) {
+            v.m_vtable->move(m_storage, v.m_storage);
+            m_vtable = v.m_vtable;
+            v.m_vtable = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) char m_storage[InlineSize];
+    const VTable *m_vtable;
+};
+
+template<class F> const fcTask::VTable fcTask::InlineImpl<F>::s_vtable = { &invoke, &move, &destroy };
+template<class F> const fcTask::VTable fcTask::HeapImpl<F>::s_vtable = { &invoke, &move, &destroy };
+
+// run a task on the pool without a task group. nothing waits for it.
+void fcEnqueueTask(fcTask &&task, fcTaskPriority priority = fcTaskPriority_Realtime);
+// number of threads that run tasks of the pool. use this rather than hardware_concurrency() to size parallel work.
+size_t fcGetNumWorkerThreads();
+
+
+// ring buffer of tasks that can be pushed / popped at both ends.
+// capacity only grows (doubles), so a queue that has reached its working size never allocates again.
+class fcTaskRing
+{
+public:
+    fcTaskRing();
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+    void push_back(fcTask &&task);
+    // must not be empty
+    fcTask pop_front();
+    fcTask pop_back();
+
+private:
+    void grow();
+
+    std::vector<fcTask> m_tasks; // size is power of 2
+    size_t m_head;
+    size_t m_size;
+};
+
+
+// counting semaphore. used to limit the number of in-flight tasks of an exporter.
+class fcSemaphore
+{
+public:
+    fcSemaphore(int count);
+    // block until a slot is available and take it
+    void acquire();
+    // take a slot if available. never blocks.
+    bool tryAcquire();
+    void release();
+    // number of available slots
+    int getCount() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    int m_count;
+};
+
+
+// lock-free stack of indices [0, capacity). pop() sleeps on a condition variable only while the stack is empty.
+class fcIndexFreeList
+{
+public:
+    fcIndexFreeList();
+    // make all indices free. must not be called while other threads are using this.
+    void reset(int capacity);
+    // return -1 if empty. never blocks.
+    int tryPop();
+    // block until an index is free
+    int pop();
+    void push(int index);
+
+private:
+    std::unique_ptr< std::atomic<uint32_t>[] > m_next; // (next index + 1) of each entry. 0 is the end
+    std::atomic<uint64_t> m_head; // (tag << 32) | (index + 1). tag is bumped on each update to avoid ABA
+    std::atomic_int m_num_waiting;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+};
+
+// completion handle of an asynchronous export (see fcJobPoll() etc).
+// reference counted: the caller and the worker that completes it each hold a reference.
+// all methods are virtual so that a job created in one module can be completed by a split module (FrameCapturer_PNG etc).
+class fcJob
+{
+public:
+    fcJob(fcJobCallback_t cb = nullptr, void *userdata = nullptr);
+    virtual void addRef();
+    virtual void release();
+    virtual fcJobState poll();
+    // timeout_ms < 0: wait infinitely
+    virtual fcJobState wait(int timeout_ms);
+    // called by the worker when the job is done. calls the callback, then wakes waiters.
+    virtual void complete(bool succeeded);
+
+protected:
+    virtual ~fcJob();
+
+private:
+    std::atomic_int m_ref;
+    std::atomic_int m_state;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    fcJobCallback_t m_callback;
+    void *m_userdata;
+};
+
+// objects of T created on every frame (states of fcParallelForAsync() etc). the memory of destroyed objects is kept
+// and reused, so that create() doesn't allocate once as many objects as used at once have been created.
+template<class T>
+class fcObjectPool
+{
+public:
+    template<class... Args>
+    static T* create(Args&&... args)
+    {
+        void *mem = nullptr;
+        {
+            Blocks& blocks = getBlocks();
+            std::unique_lock<std::mutex> lock(blocks.mutex);
+            if (!blocks.free.empty()) {
+                mem = blocks.free.back();
+                blocks.free.pop_back();
+            }
+        }
+        if (!mem) { mem = ::operator new(sizeof(T)); }
+        return new (mem) T(std::forward<Args>(args)...);
+    }
+
+    static void destroy(T *v)
+    {
+        v->~T();
+        Blocks& blocks = getBlocks();
+        std::unique_lock<std::mutex> lock(blocks.mutex);
+        blocks.free.push_back(v);
+    }
+
+private:
+    struct Blocks
+    {
+        std::mutex mutex;
+        std::vector<void*> free;
+
+        ~Blocks() { for (void *p : free) { ::operator delete(p); } }
+    };
+    static Blocks& getBlocks()
+    {
+        static Blocks s_blocks;
+        return s_blocks;
+    }
+};
+
+// blocking free list of pre-allocated objects. items must be contiguous (e.g. elements of a std::vector).
+template<class T>
+class fcFreeList
+{
+public:
+    fcFreeList() : m_items() {}
+    void reset(T *items, int num) { m_items = items; m_indices.reset(num); }
+    // nullptr if all items are in use
+    T* tryAcquire()
+    {
+        int i = m_indices.tryPop();
+        return i >= 0 ? &m_items[i] : nullptr;
+    }
+    // block until an item is released
+    T* acquire() { return &m_items[m_indices.pop()]; }
+    void release(T *v) { m_indices.push(int(v - m_items)); }
+
+private:
+    T *m_items;
+    fcIndexFreeList m_indices;
+};
+
+
+#ifndef fcWithTBB
+
+#include <thread>
 
 class fcWorkerThread;
 class fcThreadPool;
 class fcTaskGroup;
 
 
+// work-stealing thread pool.
+// each worker has its own task queue. tasks enqueued from a worker thread go to its own queue (LIFO for the owner),
+// tasks from other threads are distributed round-robin. idle workers steal from the opposite end of other queues.
+//
+// each queue has a lane per fcTaskPriority. realtime tasks are picked first, background tasks run on at most
+// (num workers - 1) threads so that a realtime task never waits for a long background task to finish.
+// a worker that has run fcMaxRealtimeStreak realtime tasks in a row while background tasks are waiting picks a background one.
 class fcThreadPool
 {
 friend class fcWorkerThread;
-friend class fcTaskGroup;
 public:
     static fcThreadPool& getInstance();
-    void enqueue(const std::function<void()> &f);
+    void enqueue(fcTask &&task, fcTaskPriority priority = fcTaskPriority_Realtime);
+    size_t getNumWorkers() const;
 
 private:
     fcThreadPool(size_t);
     ~fcThreadPool();
 
+    // pop a task by priority. priority of the popped task is stored to dst_priority.
+    // background tasks must be finished by endBackgroundTask().
+    bool popTask(fcTask &dst, fcTaskPriority &dst_priority, int worker_index, bool prefer_background);
+    // pop from the lane of worker_index (if any), then try to steal from others.
+    bool popTaskFromLane(fcTask &dst, fcTaskPriority priority, int worker_index);
+    void endBackgroundTask();
+    // true if there are tasks that can be started now.
+    bool hasRunnableTasks() const;
+    // block until tasks are available. return false if the pool is stopping.
+    bool waitTasks();
+    // index of the calling thread if it is a worker of this pool, otherwise -1.
+    int getCurrentWorkerIndex() const;
+
 private:
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        fcTaskRing tasks[fcTaskPriority_Count];
+    };
+    typedef std::unique_ptr<TaskQueue> TaskQueuePtr;
+
     std::vector< std::thread > m_workers;
-    std::deque< std::function<void()> > m_tasks;
-    std::mutex m_queue_mutex;
+    std::vector< TaskQueuePtr > m_queues;
+    std::atomic_int m_num_tasks[fcTaskPriority_Count];
+    std::atomic_int m_num_running_background;
+    int m_max_running_background;
+    std::atomic_int m_num_sleeping;
+    std::atomic_uint m_next_queue;
+    std::mutex m_sleep_mutex;
     std::condition_variable m_condition;
-    bool m_stop;
+    std::atomic_bool m_stop;
 };
 
 
@@ -42,28 +337,152 @@ class fcTaskGroup
 public:
     fcTaskGroup();
     ~fcTaskGroup(); // ** destructor don't wait tasks finished **
-    template<class F> void run(const F &f);
+    fcTaskGroup(const fcTaskGroup&) = delete;
+    fcTaskGroup& operator=(const fcTaskGroup&) = delete;
+    template<class F> void run(const F &f, fcTaskPriority priority = fcTaskPriority_Realtime);
+
+    // run not-yet-started tasks of this group on the calling thread, then block until all tasks of this group are finished.
+    // tasks of other groups are never executed here.
     void wait();
 
+    // block until all tasks of this group are finished or timeout_ms elapsed. doesn't run tasks on the calling thread.
+    // return true if all tasks are finished.
+    bool wait_for(int timeout_ms);
+
 private:
-    std::atomic_int m_active_tasks;
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        fcTaskRing tasks[fcTaskPriority_Count]; // not yet started
+        std::atomic_int active_tasks;
+        std::atomic_int ref; // this group and its queued pool tasks
+
+        State() : active_tasks(0), ref(0) {}
+    };
+    struct StatePool;
+
+    void runImpl(fcTask &&task, fcTaskPriority priority);
+    static bool runOne(State &state, fcTaskPriority priority);
+    // states are recycled (fcParallelFor() creates a group each call). they are kept constructed, so that
+    // the task rings keep their capacity.
+    static StatePool& getStatePool();
+    static State* acquireState();
+    static void releaseState(State *state);
+
+    // shared with queued pool tasks, as they may outlive this group
+    State *m_state;
 };
 
 template<class F>
-void fcTaskGroup::run(const F &f)
+void fcTaskGroup::run(const F &f, fcTaskPriority priority)
 {
-    ++m_active_tasks;
-    fcThreadPool::getInstance().enqueue([this, f](){
-        f();
-        --m_active_tasks;
-    });
+    runImpl(fcTask(f), priority);
 }
 
 #else // fcWithTBB
 
 #include <tbb/tbb.h>
-typedef tbb::task_group fcTaskGroup;
+
+// priorities are left to tbb's scheduler
+class fcTaskGroup : public tbb::task_group
+{
+public:
+    fcTaskGroup() : m_state(std::make_shared<State>()) {}
+
+    template<class F> void run(const F &f, fcTaskPriority /*priority*/ = fcTaskPriority_Realtime)
+    {
+        ++m_state->active_tasks;
+        StatePtr state = m_state;
+        tbb::task_group::run([state, f]() {
+            f();
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (--state->active_tasks == 0) { state->condition.notify_all(); }
+        });
+    }
+
+    // block until all tasks of this group are finished or timeout_ms elapsed. doesn't run tasks on the calling thread.
+    // return true if all tasks are finished.
+    bool wait_for(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        return m_state->condition.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+            [this]() { return m_state->active_tasks == 0; });
+    }
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic_int active_tasks;
+
+        State() : active_tasks(0) {}
+    };
+    typedef std::shared_ptr<State> StatePtr;
+
+    // shared with the tasks, as they may outlive this group
+    StatePtr m_state;
+};
 
 #endif // fcWithTBB
 
+
+// number of chunks to split [0, num) into, each of them has at least grain elements (except when num < grain)
+inline size_t fcGetNumChunks(size_t num, size_t grain)
+{
+    if (grain == 0 || num <= grain) { return 1; }
+    return num / grain;
+}
+
+// call body(begin, end) for ranges of [0, num) in parallel and return when all are done.
+// the calling thread runs ranges too, so this can be called from a worker.
+template<class Body>
+void fcParallelFor(size_t num, size_t grain, const Body& body, fcTaskPriority priority = fcTaskPriority_Realtime)
+{
+    size_t num_chunks = fcGetNumChunks(num, grain);
+    if (num_chunks <= 1) {
+        body(size_t(0), num);
+        return;
+    }
+
+    fcTaskGroup group;
+    for (size_t ci = 1; ci < num_chunks; ++ci) {
+        size_t begin = num * ci / num_chunks;
+        size_t end = num * (ci + 1) / num_chunks;
+        group.run([&body, begin, end]() { body(begin, end); }, priority);
+    }
+    body(size_t(0), num / num_chunks);
+    group.wait();
+}
+
+// asynchronous version of fcParallelFor(). body and done are copied. done() is called once on the thread that
+// finishes the last range. the copies are held in a recycled state, so this doesn't allocate in steady state.
+template<class Body, class Done>
+void fcParallelForAsync(size_t num, size_t grain, const Body& body, const Done& done, fcTaskPriority priority = fcTaskPriority_Realtime)
+{
+    struct State
+    {
+        Body body;
+        Done done;
+        std::atomic<size_t> remaining;
+
+        State(const Body& b, const Done& d, size_t n) : body(b), done(d), remaining(n) {}
+    };
+
+    size_t num_chunks = fcGetNumChunks(num, grain);
+    State *state = fcObjectPool<State>::create(body, done, num_chunks);
+    for (size_t ci = 0; ci < num_chunks; ++ci) {
+        size_t begin = num * ci / num_chunks;
+        size_t end = num * (ci + 1) / num_chunks;
+        fcEnqueueTask([state, begin, end]() {
+            state->body(begin, end);
+            if (--state->remaining == 0) {
+                state->done();
+                fcObjectPool<State>::destroy(state);
+            }
+        }, priority);
+    }
+}
+
 #endif // fcThreadPool_h
@@ -1,5 +1,6 @@
 ﻿#include "pch.h"
 #include "fcFoundation.h"
+#include "fcThreadPool.h"
 #include "GraphicsDevice/fcGraphicsDevice.h"
 
 
@@ -27,14 +28,71 @@ fcCLinkage fcExport fcTime fcGetTime()
     return GetCurrentTimeSec();
 }
 
+fcCLinkage fcExport bool fcSetThreadPoolConfig(const fcThreadPoolConfig *conf)
+{
+    fcThreadPoolConfig default_conf;
+    if (conf == nullptr) { conf = &default_conf; }
+    return fcSetWorkerThreadConfig(*conf);
+}
+
+#ifndef fcStaticLink
+// split modules have their own thread pool. pass the config before they start worker threads.
+static void fcSetupSplitModule(module_t mod)
+{
+    typedef bool (*fcSetThreadPoolConfigImplT)(const fcThreadPoolConfig *conf);
+    auto set_config = (fcSetThreadPoolConfigImplT)DLLGetSymbol(mod, "fcSetThreadPoolConfigImpl");
+    if (set_config) {
+        set_config(&fcGetWorkerThreadConfig());
+    }
+}
+#endif // fcStaticLink
+
+fcCLinkage fcExport fcJobState fcJobPoll(fcJob *job)
+{
+    if (!job) { return fcJobState_Failed; }
+    return job->poll();
+}
+
+fcCLinkage fcExport fcJobState fcJobWait(fcJob *job, int timeout_ms)
+{
+    if (!job) { return fcJobState_Failed; }
+    return job->wait(timeout_ms);
+}
+
+fcCLinkage fcExport void fcJobRelease(fcJob *job)
+{
+    if (!job) { return; }
+    job->release();
+}
+
+fcCLinkage fcExport fcJob* fcConvertPixelFormatAsync(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, int num_pixels, fcJobCallback_t cb, void *userdata)
+{
+    if (!dst || !src || num_pixels < 0) { return nullptr; }
+    auto *job = new fcJob(cb, userdata);
+    fcKickConvertPixelFormat(job, dst, dstfmt, src, srcfmt, num_pixels);
+    return job;
+}
+
 fcCLinkage fcExport fcStream* fcCreateFileStream(const char *path)
 {
-    return new StdIOStream(new std::fstream(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc), true);
+    return new FileStream(path);
+}
+fcCLinkage fcExport fcStream* fcCreateAsyncFileStream(const char *path, size_t max_pending_bytes)
+{
+    return new AsyncFileStream(path, max_pending_bytes);
+}
+fcCLinkage fcExport fcStream* fcCreateMappedFileStream(const char *path, size_t window_size)
+{
+    return new MappedFileStream(path, window_size);
 }
 fcCLinkage fcExport fcStream* fcCreateMemoryStream()
 {
     return new BufferStream(new Buffer(), true);
 }
+fcCLinkage fcExport fcStream* fcCreateSegmentedMemoryStream(size_t segment_size)
+{
+    return new SegmentedBufferStream(segment_size);
+}
 fcCLinkage fcExport fcStream* fcCreateCustomStream(void *obj, fcTellp_t tellp, fcSeekp_t seekp, fcWrite_t write)
 {
     CustomStreamData csd;
@@ -44,12 +102,35 @@ fcCLinkage fcExport fcStream* fcCreateCustomStream(void *obj, fcTellp_t tellp, f
     csd.write = write;
     return new CustomStream(csd);
 }
+fcCLinkage fcExport fcStream* fcCreateCustomStreamWritev(void *obj, fcTellp_t tellp, fcSeekp_t seekp, fcWrite_t write, fcWritev_t writev)
+{
+    static_assert(sizeof(IOBuffer) == sizeof(fcBufferData), "IOBuffer and fcBufferData must have the same layout");
+    CustomStreamData csd;
+    csd.obj = obj;
+    csd.tellp = tellp;
+    csd.seekp = seekp;
+    csd.write = write;
+    csd.writev = (writev_t)writev;
+    return new CustomStream(csd);
+}
 
 fcCLinkage fcExport void fcDestroyStream(fcStream *s)
 {
     delete s;
 }
 
+fcCLinkage fcExport void fcStreamFlush(fcStream *s)
+{
+    if (!s) { return; }
+    s->flush();
+}
+
+fcCLinkage fcExport bool fcStreamFailed(fcStream *s)
+{
+    if (!s) { return true; }
+    return s->failed();
+}
+
 fcCLinkage fcExport fcBufferData fcStreamGetBufferData(fcStream *s)
 {
     fcBufferData ret;
@@ -60,6 +141,34 @@ fcCLinkage fcExport fcBufferData fcStreamGetBufferData(fcStream *s)
     return ret;
 }
 
+fcCLinkage fcExport int fcStreamGetNumSegments(fcStream *s)
+{
+    if (BufferStream *bs = dynamic_cast<BufferStream*>(s)) {
+        return bs->get().empty() ? 0 : 1;
+    }
+    else if (SegmentedBufferStream *ss = dynamic_cast<SegmentedBufferStream*>(s)) {
+        return (int)ss->getNumSegments();
+    }
+    return 0;
+}
+
+fcCLinkage fcExport fcBufferData fcStreamGetSegment(fcStream *s, int i)
+{
+    fcBufferData ret;
+    if (i < 0 || i >= fcStreamGetNumSegments(s)) { return ret; }
+
+    if (BufferStream *bs = dynamic_cast<BufferStream*>(s)) {
+        ret.data = bs->get().ptr();
+        ret.size = bs->get().size();
+    }
+    else if (SegmentedBufferStream *ss = dynamic_cast<SegmentedBufferStream*>(s)) {
+        DataRef seg = ss->getSegment(i);
+        ret.data = seg.ptr();
+        ret.size = seg.size();
+    }
+    return ret;
+}
+
 fcCLinkage fcExport uint64_t fcStreamGetWrittenSize(fcStream *s)
 {
     return s->tellp();
@@ -153,6 +262,7 @@ fcCLinkage fcExport fcIPngContext* fcPngCreateContext(const fcPngConfig *conf)
     if (!fcPngModule) {
         fcPngModule = DLLLoad(fcPNGModuleName);
         if (fcPngModule) {
+            fcSetupSplitModule(fcPngModule);
             (void*&)fcPngCreateContextImpl = DLLGetSymbol(fcPngModule, "fcPngCreateContextImpl");
         }
     }
@@ -174,12 +284,76 @@ fcCLinkage fcExport bool fcPngExportPixels(fcIPngContext *ctx, const char *path,
     return ctx->exportPixels(path, pixels, width, height, fmt, flipY);
 }
 
+fcCLinkage fcExport fcJob* fcPngExportPixelsAsync(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY, fcJobCallback_t cb, void *userdata)
+{
+    if (!ctx) { return nullptr; }
+    auto *job = new fcJob(cb, userdata);
+    if (!ctx->exportPixels(path, pixels, width, height, fmt, flipY, job)) {
+        job->release();
+        return nullptr;
+    }
+    return job;
+}
+
 fcCLinkage fcExport bool fcPngExportTexture(fcIPngContext *ctx, const char *path, void *tex, int width, int height, fcPixelFormat fmt, bool flipY)
 {
     if (!ctx) { return false; }
     return ctx->exportTexture(path, tex, width, height, fmt, flipY);
 }
 
+fcCLinkage fcExport int fcPngGetActiveTaskCount(fcIPngContext *ctx)
+{
+    if (!ctx) { return 0; }
+    return ctx->getActiveTaskCount();
+}
+
+fcCLinkage fcExport bool fcPngExportPixelsToStream(fcIPngContext *ctx, fcStream *stream, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY)
+{
+    if (!ctx || !stream) { return false; }
+    fcPngOutput out;
+    out.stream = stream;
+    return ctx->exportPixels(out, pixels, width, height, fmt, flipY);
+}
+
+fcCLinkage fcExport fcJob* fcPngExportPixelsToStreamAsync(fcIPngContext *ctx, fcStream *stream, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY, fcJobCallback_t cb, void *userdata)
+{
+    if (!ctx || !stream) { return nullptr; }
+    fcPngOutput out;
+    out.stream = stream;
+    auto *job = new fcJob(cb, userdata);
+    if (!ctx->exportPixels(out, pixels, width, height, fmt, flipY, job)) {
+        job->release();
+        return nullptr;
+    }
+    return job;
+}
+
+fcCLinkage fcExport bool fcPngExportTextureToStream(fcIPngContext *ctx, fcStream *stream, void *tex, int width, int height, fcPixelFormat fmt, bool flipY)
+{
+    if (!ctx || !stream) { return false; }
+    fcPngOutput out;
+    out.stream = stream;
+    return ctx->exportTexture(out, tex, width, height, fmt, flipY);
+}
+
+fcCLinkage fcExport bool fcPngExportPixelsToCallback(fcIPngContext *ctx, fcPngDataCallback_t data_cb, void *data_userdata, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY)
+{
+    if (!ctx || !data_cb) { return false; }
+    fcPngOutput out;
+    out.data_cb = data_cb;
+    out.data_userdata = data_userdata;
+    return ctx->exportPixels(out, pixels, width, height, fmt, flipY);
+}
+
+fcCLinkage fcExport bool fcPngExportTextureToCallback(fcIPngContext *ctx, fcPngDataCallback_t data_cb, void *data_userdata, void *tex, int width, int height, fcPixelFormat fmt, bool flipY)
+{
+    if (!ctx || !data_cb) { return false; }
+    fcPngOutput out;
+    out.data_cb = data_cb;
+    out.data_userdata = data_userdata;
+    return ctx->exportTexture(out, tex, width, height, fmt, flipY);
+}
+
 #ifndef fcStaticLink
 fcCLinkage fcExport int fcPngExportTextureDeferred(fcIPngContext *ctx, const char *path_, void *tex, int width, int height, fcPixelFormat fmt, bool flipY, int id)
 {
@@ -217,6 +391,7 @@ fcCLinkage fcExport fcIExrContext* fcExrCreateContext(const fcExrConfig *conf)
     if (!fcExrModule) {
         fcExrModule = DLLLoad(fcEXRModuleName);
         if (fcExrModule) {
+            fcSetupSplitModule(fcExrModule);
             (void*&)fcExrCreateContextImpl = DLLGetSymbol(fcExrModule, "fcExrCreateContextImpl");
         }
     }
@@ -256,6 +431,23 @@ fcCLinkage fcExport bool fcExrEndFrame(fcIExrContext *ctx)
     return ctx->endFrame();
 }
 
+fcCLinkage fcExport fcJob* fcExrEndFrameAsync(fcIExrContext *ctx, fcJobCallback_t cb, void *userdata)
+{
+    if (!ctx) { return nullptr; }
+    auto *job = new fcJob(cb, userdata);
+    if (!ctx->endFrame(job)) {
+        job->release();
+        return nullptr;
+    }
+    return job;
+}
+
+fcCLinkage fcExport int fcExrGetActiveTaskCount(fcIExrContext *ctx)
+{
+    if (!ctx) { return 0; }
+    return ctx->getActiveTaskCount();
+}
+
 #ifndef fcStaticLink
 fcCLinkage fcExport int fcExrBeginFrameDeferred(fcIExrContext *ctx, const char *path_, int width, int height, int id)
 {
@@ -308,6 +500,7 @@ fcCLinkage fcExport fcIGifContext* fcGifCreateContext(const fcGifConfig *conf)
     if (!fcGifModule) {
         fcGifModule = DLLLoad(fcGIFModuleName);
         if (fcGifModule) {
+            fcSetupSplitModule(fcGifModule);
             (void*&)fcExrCreateContextImpl = DLLGetSymbol(fcGifModule, "fcGifCreateContextImpl");
         }
     }
@@ -328,6 +521,16 @@ fcCLinkage fcExport bool fcGifAddFramePixels(fcIGifContext *ctx, const void *pix
     if (!ctx) { return false; }
     return ctx->addFramePixels(pixels, fmt, keyframe, timestamp);
 }
+fcCLinkage fcExport fcJob* fcGifAddFramePixelsAsync(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, bool keyframe, fcTime timestamp, fcJobCallback_t cb, void *userdata)
+{
+    if (!ctx) { return nullptr; }
+    auto *job = new fcJob(cb, userdata);
+    if (!ctx->addFramePixels(pixels, fmt, keyframe, timestamp, job)) {
+        job->release();
+        return nullptr;
+    }
+    return job;
+}
 fcCLinkage fcExport bool fcGifAddFrameTexture(fcIGifContext *ctx, void *tex, fcPixelFormat fmt, bool keyframe, fcTime timestamp)
 {
     if (!ctx) { return false; }
@@ -402,6 +605,7 @@ fcCLinkage fcExport void fcGifEraseFrame(fcIGifContext *ctx, int begin_frame, in
             if (!fcMP4Module) {
                 fcMP4Module = DLLLoad(fcMP4ModuleName);
                 if (fcMP4Module) {
+                    fcSetupSplitModule(fcMP4Module);
 #define imp(Name) (void*&)Name = DLLGetSymbol(fcMP4Module, #Name);
                     fcMP4EachFunctions(imp)
 #undef imp
@@ -492,6 +696,16 @@ fcCLinkage fcExport bool fcMP4AddVideoFramePixels(fcIMP4Context *ctx, const void
     if (!ctx) { return false; }
     return ctx->addVideoFramePixels(pixels, fmt, timestamp);
 }
+fcCLinkage fcExport fcJob* fcMP4AddVideoFramePixelsAsync(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp, fcJobCallback_t cb, void *userdata)
+{
+    if (!ctx) { return nullptr; }
+    auto *job = new fcJob(cb, userdata);
+    if (!ctx->addVideoFramePixels(pixels, fmt, timestamp, job)) {
+        job->release();
+        return nullptr;
+    }
+    return job;
+}
 fcCLinkage fcExport bool fcMP4AddVideoFrameTexture(fcIMP4Context *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp)
 {
     if (!ctx) { return false; }
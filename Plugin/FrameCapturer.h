@@ -23,6 +23,7 @@ class fcIPngContext;
 class fcIExrContext;
 class fcIGifContext;
 class fcIMP4Context;
+class fcJob;
 typedef double fcTime;
 
 enum fcPixelFormat
@@ -60,6 +61,15 @@ enum fcPixelFormat
     fcPixelFormat_I420      = 0x10 << 4,
 };
 
+// scheduling class of encoder tasks on the shared thread pool.
+// realtime tasks are always picked first, and background tasks never occupy all workers.
+enum fcTaskPriority
+{
+    fcTaskPriority_Realtime,    // short, latency sensitive tasks (png / gif frames)
+    fcTaskPriority_Background,  // long running tasks (exr compression)
+    fcTaskPriority_Count,
+};
+
 
 // -------------------------------------------------------------
 // Foundation
@@ -75,6 +85,18 @@ fcCLinkage fcExport void            fcSetModulePath(const char *path);
 fcCLinkage fcExport const char*     fcGetModulePath();
 fcCLinkage fcExport fcTime          fcGetTime(); // current time in seconds
 
+// settings of worker threads. applied to the thread pool and mp4 encoder threads.
+struct fcThreadPoolConfig
+{
+    int num_workers;            // number of thread pool workers. <= 0: std::thread::hardware_concurrency()
+    uint64_t affinity_mask;     // bit n = logical processor n. 0: no restriction. (ignored on Mac)
+    int priority;               // -2 (lowest) to 2 (highest). 0: OS default. nice value is -priority * 5 on non-Windows
+    const char *name_prefix;    // threads are named "<name_prefix>Worker<N>", "<name_prefix>MP4Video" etc. null: don't name
+    fcThreadPoolConfig() : num_workers(0), affinity_mask(0), priority(0), name_prefix("fc") {}
+};
+// must be called before any exporter context is created. return false if worker threads are already running.
+fcCLinkage fcExport bool            fcSetThreadPoolConfig(const fcThreadPoolConfig *conf);
+
 
 #ifndef fcImpl
 struct fcStream;
@@ -91,27 +113,132 @@ struct fcBufferData
 
     fcBufferData() : data(), size() {}
 };
+// vectored write for custom stream. buffers must be written in order.
+typedef size_t(*fcWritev_t)(void *obj, const fcBufferData *buffers, int num_buffers);
 fcCLinkage fcExport fcStream*       fcCreateFileStream(const char *path);
+// file stream that writes in the background (io_uring on linux, a writer thread on others).
+// writes block only when more than max_pending_bytes are waiting for the disk. 0: default (64MB)
+fcCLinkage fcExport fcStream*       fcCreateAsyncFileStream(const char *path, size_t max_pending_bytes = 0);
+// file stream that writes into memory mapped windows of the file. back-patches (e.g. mp4 box sizes) are plain memory stores.
+// window_size == 0: default (64MB)
+fcCLinkage fcExport fcStream*       fcCreateMappedFileStream(const char *path, size_t window_size = 0);
 fcCLinkage fcExport fcStream*       fcCreateMemoryStream();
+// memory stream that stores data in segment_size chunks instead of one contiguous block. suitable for long recordings.
+// segment_size == 0: default (4MB). use fcStreamGetNumSegments() / fcStreamGetSegment() to read the data.
+fcCLinkage fcExport fcStream*       fcCreateSegmentedMemoryStream(size_t segment_size = 0);
+// writes to custom streams are combined in a buffer, so the callbacks are called for large blocks only.
+// call fcStreamFlush() (or destroy the stream) before reading the result on the callee side.
 fcCLinkage fcExport fcStream*       fcCreateCustomStream(void *obj, fcTellp_t tellp, fcSeekp_t seekp, fcWrite_t write);
+// same as fcCreateCustomStream() but writev is used to pass the buffer and large writes in one call.
+fcCLinkage fcExport fcStream*       fcCreateCustomStreamWritev(void *obj, fcTellp_t tellp, fcSeekp_t seekp, fcWrite_t write, fcWritev_t writev);
 fcCLinkage fcExport void            fcDestroyStream(fcStream *s);
+// pass buffered data to the file / callbacks
+fcCLinkage fcExport void            fcStreamFlush(fcStream *s);
+// true if any data could not be written to the file / callbacks. call fcStreamFlush() first to include buffered data.
+fcCLinkage fcExport bool            fcStreamFailed(fcStream *s);
 fcCLinkage fcExport fcBufferData    fcStreamGetBufferData(fcStream *s); // s must be created by fcCreateMemoryStream(), otherwise return {nullptr, 0}.
+// iterate the written data of memory streams without copying. the data is the concatenation of all segments in order.
+// fcCreateMemoryStream(): 1 segment if not empty. other than memory streams: 0 segments.
+fcCLinkage fcExport int             fcStreamGetNumSegments(fcStream *s);
+fcCLinkage fcExport fcBufferData    fcStreamGetSegment(fcStream *s, int i);
 fcCLinkage fcExport uint64_t        fcStreamGetWrittenSize(fcStream *s);
 
 
+// job handle of asynchronous exports (fc*Async() functions).
+// the handle must be released by fcJobRelease() even after the job is finished.
+enum fcJobState
+{
+    fcJobState_Pending,
+    fcJobState_Succeeded,
+    fcJobState_Failed,
+};
+// called on a worker thread when the job is finished
+typedef void(*fcJobCallback_t)(fcJob *job, fcJobState state, void *userdata);
+
+fcCLinkage fcExport fcJobState      fcJobPoll(fcJob *job);
+// timeout_ms < 0: wait infinitely. return fcJobState_Pending if timed out.
+fcCLinkage fcExport fcJobState      fcJobWait(fcJob *job, int timeout_ms = -1);
+fcCLinkage fcExport void            fcJobRelease(fcJob *job);
+
+// convert num_pixels pixels on worker threads. dst is always written, even if the formats are same.
+// src and dst must be kept alive until the job is finished.
+fcCLinkage fcExport fcJob*          fcConvertPixelFormatAsync(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, int num_pixels, fcJobCallback_t cb = nullptr, void *userdata = nullptr);
+
+
 // -------------------------------------------------------------
 // PNG Exporter
 // -------------------------------------------------------------
 
+// speed / size trade-off of png compression. compression_level, compression_strategy and filters override parts of it.
+enum fcPngPreset
+{
+    fcPngPreset_Balanced,   // zlib level 6, filtered strategy, adaptive filters (libpng's default)
+    fcPngPreset_Fastest,    // zlib level 1, rle strategy, sub filter
+    fcPngPreset_Smallest,   // zlib level 9, filtered strategy, adaptive filters
+};
+// same values as zlib's Z_*_STRATEGY
+enum fcPngStrategy
+{
+    fcPngStrategy_Preset = -1,
+    fcPngStrategy_Default = 0,
+    fcPngStrategy_Filtered = 1,
+    fcPngStrategy_HuffmanOnly = 2,
+    fcPngStrategy_RLE = 3,
+    fcPngStrategy_Fixed = 4,
+};
+// row filters to choose from. if more than one, the filter is chosen for each row
+enum fcPngFilter
+{
+    fcPngFilter_Preset  = 0,
+    fcPngFilter_None    = 1 << 0,
+    fcPngFilter_Sub     = 1 << 1,
+    fcPngFilter_Up      = 1 << 2,
+    fcPngFilter_Average = 1 << 3,
+    fcPngFilter_Paeth   = 1 << 4,
+    fcPngFilter_All     = 0x1f,
+};
+// deflate implementation
+enum fcPngBackend
+{
+    fcPngBackend_Zlib,  // zlib. compression_level and compression_strategy are used
+    fcPngBackend_Fast,  // built-in greedy LZ77 + huffman encoder (fpng style). several times faster, files are larger. ignores compression_level and compression_strategy
+};
+
 struct fcPngConfig
 {
     int max_active_tasks;
-    fcPngConfig() : max_active_tasks(8) {}
+    fcTaskPriority task_priority;
+    bool non_blocking; // if true, export fails immediately instead of waiting when all max_active_tasks slots are in use
+    bool parallel_encoding; // if true, each image is split into row strips that are filtered and compressed in parallel. lowers latency of 4K / 8K frames
+    fcPngPreset preset;
+    int compression_level; // 0-9. -1: by preset
+    fcPngStrategy compression_strategy;
+    int filters; // combination of fcPngFilter. fcPngFilter_Preset: by preset
+    fcPngBackend backend;
+    fcPngConfig()
+        : max_active_tasks(8), task_priority(fcTaskPriority_Realtime), non_blocking(false), parallel_encoding(false)
+        , preset(fcPngPreset_Balanced), compression_level(-1), compression_strategy(fcPngStrategy_Preset), filters(fcPngFilter_Preset)
+        , backend(fcPngBackend_Zlib)
+    {}
 };
 fcCLinkage fcExport fcIPngContext*  fcPngCreateContext(const fcPngConfig *conf = nullptr);
 fcCLinkage fcExport void            fcPngDestroyContext(fcIPngContext *ctx);
 fcCLinkage fcExport bool            fcPngExportPixels(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY = false);
+// return nullptr if the export couldn't be started. pixels can be reused when this returns.
+fcCLinkage fcExport fcJob*          fcPngExportPixelsAsync(fcIPngContext *ctx, const char *path, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY = false, fcJobCallback_t cb = nullptr, void *userdata = nullptr);
 fcCLinkage fcExport bool            fcPngExportTexture(fcIPngContext *ctx, const char *path, void *tex, int width, int height, fcPixelFormat fmt, bool flipY = false);
+fcCLinkage fcExport int             fcPngGetActiveTaskCount(fcIPngContext *ctx); // number of max_active_tasks slots in use
+// export to a stream instead of a file. the png is encoded in memory and written to the stream at once when done,
+// so exports to the same stream are never interleaved. they are written in order of completion
+// (= order of submission if max_active_tasks is 1). the stream must be kept alive until the export is finished.
+fcCLinkage fcExport bool            fcPngExportPixelsToStream(fcIPngContext *ctx, fcStream *stream, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY = false);
+fcCLinkage fcExport fcJob*          fcPngExportPixelsToStreamAsync(fcIPngContext *ctx, fcStream *stream, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY = false, fcJobCallback_t cb = nullptr, void *userdata = nullptr);
+fcCLinkage fcExport bool            fcPngExportTextureToStream(fcIPngContext *ctx, fcStream *stream, void *tex, int width, int height, fcPixelFormat fmt, bool flipY = false);
+// pass the encoded png to data_cb instead of writing a file. data_cb is called on a worker thread, and data is valid
+// only during the call. not called if the export failed.
+typedef void(*fcPngDataCallback_t)(const void *data, size_t size, void *userdata);
+fcCLinkage fcExport bool            fcPngExportPixelsToCallback(fcIPngContext *ctx, fcPngDataCallback_t data_cb, void *data_userdata, const void *pixels, int width, int height, fcPixelFormat fmt, bool flipY = false);
+fcCLinkage fcExport bool            fcPngExportTextureToCallback(fcIPngContext *ctx, fcPngDataCallback_t data_cb, void *data_userdata, void *tex, int width, int height, fcPixelFormat fmt, bool flipY = false);
 
 
 // -------------------------------------------------------------
@@ -121,7 +248,9 @@ fcCLinkage fcExport bool            fcPngExportTexture(fcIPngContext *ctx, const
 struct fcExrConfig
 {
     int max_active_tasks;
-    fcExrConfig() : max_active_tasks(8) {}
+    fcTaskPriority task_priority;
+    bool non_blocking; // if true, beginFrame fails immediately instead of waiting when all max_active_tasks slots are in use
+    fcExrConfig() : max_active_tasks(8), task_priority(fcTaskPriority_Background), non_blocking(false) {}
 };
 fcCLinkage fcExport fcIExrContext*  fcExrCreateContext(const fcExrConfig *conf = nullptr);
 fcCLinkage fcExport void            fcExrDestroyContext(fcIExrContext *ctx);
@@ -129,6 +258,9 @@ fcCLinkage fcExport bool            fcExrBeginFrame(fcIExrContext *ctx, const ch
 fcCLinkage fcExport bool            fcExrAddLayerPixels(fcIExrContext *ctx, const void *pixels, fcPixelFormat fmt, int ch, const char *name, bool flipY = false);
 fcCLinkage fcExport bool            fcExrAddLayerTexture(fcIExrContext *ctx, void *tex, fcPixelFormat fmt, int ch, const char *name, bool flipY = false);
 fcCLinkage fcExport bool            fcExrEndFrame(fcIExrContext *ctx);
+// return nullptr if the frame couldn't be submitted. the job is finished when the file is written.
+fcCLinkage fcExport fcJob*          fcExrEndFrameAsync(fcIExrContext *ctx, fcJobCallback_t cb = nullptr, void *userdata = nullptr);
+fcCLinkage fcExport int             fcExrGetActiveTaskCount(fcIExrContext *ctx); // number of max_active_tasks slots in use
 
 
 // -------------------------------------------------------------
@@ -141,13 +273,17 @@ struct fcGifConfig
     int height;
     int num_colors;
     int max_active_tasks;
+    fcTaskPriority task_priority;
+    bool non_blocking; // if true, frames are dropped (add* returns false) instead of waiting when all max_active_tasks buffers are in use
     fcGifConfig()
-        : width(), height(), num_colors(256), max_active_tasks(8) {}
+        : width(), height(), num_colors(256), max_active_tasks(8), task_priority(fcTaskPriority_Realtime), non_blocking(false) {}
 };
 fcCLinkage fcExport fcIGifContext*  fcGifCreateContext(const fcGifConfig *conf);
 fcCLinkage fcExport void            fcGifDestroyContext(fcIGifContext *ctx);
 // timestamp=-1 is treated as current time.
 fcCLinkage fcExport bool            fcGifAddFramePixels(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, bool keyframe = false, fcTime timestamp = -1.0);
+// return nullptr if the frame couldn't be added. the job is finished when the frame is encoded.
+fcCLinkage fcExport fcJob*          fcGifAddFramePixelsAsync(fcIGifContext *ctx, const void *pixels, fcPixelFormat fmt, bool keyframe = false, fcTime timestamp = -1.0, fcJobCallback_t cb = nullptr, void *userdata = nullptr);
 // timestamp=-1 is treated as current time.
 fcCLinkage fcExport bool            fcGifAddFrameTexture(fcIGifContext *ctx, void *tex, fcPixelFormat fmt, bool keyframe = false, fcTime timestamp = -1.0);
 fcCLinkage fcExport bool            fcGifWrite(fcIGifContext *ctx, fcStream *stream, int begin_frame = 0, int end_frame = -1);
@@ -177,6 +313,9 @@ struct fcMP4Config
     int     audio_sample_rate;
     int     audio_num_channels;
     int     audio_bitrate;
+    bool    video_non_blocking; // if true, video frames are dropped (add* returns false) instead of waiting when all video_max_buffers are in use
+    int     output_max_queued_frames; // max encoded frames waiting to be written per output stream. 0: default
+    bool    output_non_blocking; // if true, an output stream whose queue is full drops frames (until the next key frame) instead of stalling the encoders
 
     fcMP4Config()
         : video(true), audio(true)
@@ -184,6 +323,8 @@ struct fcMP4Config
         , video_width(), video_height()
         , video_bitrate(1024000), video_max_framerate(60), video_max_buffers(8)
         , audio_scale(1.0f), audio_sample_rate(48000), audio_num_channels(2), audio_bitrate(64000)
+        , video_non_blocking(false)
+        , output_max_queued_frames(0), output_non_blocking(false)
     {}
 };
 
@@ -204,6 +345,8 @@ fcCLinkage fcExport const char*     fcMP4GetVideoEncoderInfo(fcIMP4Context *ctx)
 fcCLinkage fcExport void            fcMP4AddOutputStream(fcIMP4Context *ctx, fcStream *stream);
 // timestamp=-1 is treated as current time.
 fcCLinkage fcExport bool            fcMP4AddVideoFramePixels(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0);
+// return nullptr if the frame couldn't be added. the job is finished when the frame is encoded and passed to the output streams.
+fcCLinkage fcExport fcJob*          fcMP4AddVideoFramePixelsAsync(fcIMP4Context *ctx, const void *pixels, fcPixelFormat fmt, fcTime timestamp = -1.0, fcJobCallback_t cb = nullptr, void *userdata = nullptr);
 // timestamp=-1 is treated as current time.
 fcCLinkage fcExport bool            fcMP4AddVideoFrameTexture(fcIMP4Context *ctx, void *tex, fcPixelFormat fmt, fcTime timestamp = -1);
 // timestamp=-1 is treated as current time.
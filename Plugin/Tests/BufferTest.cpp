@@ -0,0 +1,102 @@
+#include "TestCommon.h"
+
+
+// write total_size bytes to a memory stream in chunk_size pieces, like a long recording to fcCreateMemoryStream().
+template<class Stream> Stream* CreateBenchStream();
+template<> BufferStream* CreateBenchStream<BufferStream>() { return new BufferStream(new Buffer(), true); }
+template<> SegmentedBufferStream* CreateBenchStream<SegmentedBufferStream>() { return new SegmentedBufferStream(); }
+
+template<class Stream>
+static double BufferStreamBenchImpl(size_t total_size, size_t chunk_size)
+{
+    std::vector<char> chunk(chunk_size, 1);
+
+    auto begin = std::chrono::steady_clock::now();
+    {
+        std::unique_ptr<Stream> stream(CreateBenchStream<Stream>());
+        for (size_t written = 0; written < total_size; written += chunk_size) {
+            stream->write(&chunk[0], chunk_size);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double sec = std::chrono::duration<double>(end - begin).count();
+    return double(total_size) / sec;
+}
+
+void BufferTest()
+{
+    printf("BufferTest begin\n");
+
+    // size / capacity
+    {
+        Buffer buf;
+        buf.reserve(100);
+        const char *p = buf.ptr();
+        buf.resize(50);
+        bool keep_memory = buf.ptr() == p && buf.capacity() == 100;
+        buf.clear();
+        keep_memory = keep_memory && buf.empty() && buf.ptr() == p;
+        buf.shrink_to_fit();
+        printf("  size / capacity: %s\n", keep_memory && buf.capacity() == 0 && buf.ptr() == nullptr ? "ok" : "failed");
+    }
+
+    // append must preserve contents across reallocations
+    {
+        Buffer buf;
+        bool ok = true;
+        for (int i = 0; i < 10000; ++i) {
+            char c = (char)i;
+            buf.append(&c, 1);
+        }
+        for (int i = 0; i < 10000; ++i) {
+            if (buf[i] != (char)i) { ok = false; break; }
+        }
+        printf("  append: %s\n", ok && buf.size() == 10000 && buf.capacity() >= 10000 ? "ok" : "failed");
+    }
+
+    // SegmentedBufferStream must produce the same data as BufferStream, including seekp() patches across segments
+    {
+        BufferStream bs(new Buffer(), true);
+        SegmentedBufferStream ss(100);
+        BinaryStream *streams[] = { &bs, &ss };
+        for (BinaryStream *s : streams) {
+            for (int i = 0; i < 1000; ++i) {
+                *s << (uint32_t)i;
+            }
+            s->seekp(98);
+            *s << (uint64_t)0x0123456789abcdef; // crosses the 1st segment boundary
+            s->seekp(s->tellp() + 200);
+            *s << (uint32_t)0xffffffff;
+            s->seekp(4000);
+        }
+
+        bool ok = ss.size() == bs.get().size() && ss.getNumSegments() == 40;
+        size_t pos = 0;
+        for (size_t i = 0; ok && i < ss.getNumSegments(); ++i) {
+            DataRef seg = ss.getSegment(i);
+            ok = memcmp(seg.ptr(), bs.get().ptr() + pos, seg.size()) == 0;
+            pos += seg.size();
+        }
+
+        char tmp[300];
+        ss.seekg(50);
+        bs.seekg(50);
+        ok = ok && ss.read(tmp, 300) == 300 && memcmp(tmp, bs.get().ptr() + 50, 300) == 0;
+        printf("  segmented stream: %s\n", ok && pos == ss.size() ? "ok" : "failed");
+    }
+
+    // 1GB recording. 255 byte blocks are what the gif encoder writes, 64KB is a typical h264 frame.
+    const size_t TotalSize = 1024 * 1024 * 1024;
+    const size_t ChunkSizes[] = { 255, 64 * 1024 };
+    for (size_t chunk_size : ChunkSizes) {
+        double bps = BufferStreamBenchImpl<BufferStream>(TotalSize, chunk_size);
+        printf("  memory stream, %6d byte writes: %.2f MB/sec\n", (int)chunk_size, bps / (1024.0 * 1024.0));
+    }
+    for (size_t chunk_size : ChunkSizes) {
+        double bps = BufferStreamBenchImpl<SegmentedBufferStream>(TotalSize, chunk_size);
+        printf("  segmented memory stream, %6d byte writes: %.2f MB/sec\n", (int)chunk_size, bps / (1024.0 * 1024.0));
+    }
+
+    printf("BufferTest end\n");
+}
@@ -0,0 +1,201 @@
+#include "TestCommon.h"
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    #include <intrin.h>
+    #define fcHasRDTSC
+#elif defined(__i386__) || defined(__x86_64__)
+    #include <x86intrin.h>
+    #define fcHasRDTSC
+#endif
+
+const void* fcConvertPixelFormat(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+int fcGetNumConvertKernelISAs();
+const char* fcGetConvertKernelISAName(int isa);
+const void* fcConvertPixelFormat_ISA(int isa, void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+void fcImageFlipY(void *image_, int width, int height, fcPixelFormat fmt);
+int fcGetPixelSize(fcPixelFormat format);
+bool fcScaleArray_ISA(int isa, uint8_t *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, uint16_t *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, int32_t *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, half *data, size_t size, float scale);
+bool fcScaleArray_ISA(int isa, float *data, size_t size, float scale);
+
+
+// times every conversion pair, fcImageFlipY and fcScaleArray at capture resolutions. conversions and scales are timed
+// with each instruction set the CPU supports (scalar and each ISPC target). fcImageFlipY has no ISPC kernel, so
+// its rows (isa "c++") are not a per-ISA comparison.
+// all results go to ConvertBench.csv to track regressions between versions.
+
+namespace {
+
+struct BenchResolution
+{
+    const char *name;
+    int width, height;
+};
+
+const BenchResolution Resolutions[] = {
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4K", 3840, 2160 },
+    { "8K", 7680, 4320 },
+};
+
+const fcPixelFormat Formats[] = {
+    fcPixelFormat_RGBAu8, fcPixelFormat_RGBu8, fcPixelFormat_RGu8, fcPixelFormat_Ru8,
+    fcPixelFormat_RGBAi16, fcPixelFormat_RGBi16, fcPixelFormat_RGi16, fcPixelFormat_Ri16,
+    fcPixelFormat_RGBAi32, fcPixelFormat_RGBi32, fcPixelFormat_RGi32, fcPixelFormat_Ri32,
+    fcPixelFormat_RGBAf16, fcPixelFormat_RGBf16, fcPixelFormat_RGf16, fcPixelFormat_Rf16,
+    fcPixelFormat_RGBAf32, fcPixelFormat_RGBf32, fcPixelFormat_RGf32, fcPixelFormat_Rf32,
+};
+const int NumFormats = sizeof(Formats) / sizeof(Formats[0]);
+
+std::string GetFormatName(fcPixelFormat fmt)
+{
+    static const char *channels[] = { "", "R", "RG", "RGB", "RGBA" };
+    const char *type = "";
+    switch (fmt & fcPixelFormat_TypeMask) {
+    case fcPixelFormat_Type_u8:  type = "u8"; break;
+    case fcPixelFormat_Type_i16: type = "i16"; break;
+    case fcPixelFormat_Type_i32: type = "i32"; break;
+    case fcPixelFormat_Type_f16: type = "f16"; break;
+    case fcPixelFormat_Type_f32: type = "f32"; break;
+    }
+    return std::string(channels[fmt & fcPixelFormat_ChannelMask]) + type;
+}
+
+// TSC ticks. 0 if not available
+uint64_t GetCycles()
+{
+#ifdef fcHasRDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct BenchResult
+{
+    double ms;
+    double cycles;
+};
+
+// run body until 3 runs and 20 ms are done, and return average per run
+template<class Body>
+BenchResult Measure(const Body& body)
+{
+    int runs = 0;
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t cycles_begin = GetCycles();
+    std::chrono::steady_clock::duration elapsed;
+    do {
+        body();
+        ++runs;
+        elapsed = std::chrono::steady_clock::now() - begin;
+    } while (runs < 3 || elapsed < std::chrono::milliseconds(20));
+    uint64_t cycles_end = GetCycles();
+
+    BenchResult ret;
+    ret.ms = std::chrono::duration<double, std::milli>(elapsed).count() / runs;
+    ret.cycles = double(cycles_end - cycles_begin) / runs;
+    return ret;
+}
+
+class BenchWriter
+{
+public:
+    BenchWriter(const char *path)
+    {
+        m_file = fopen(path, "wb");
+        if (m_file) {
+            fprintf(m_file, "op,isa,resolution,width,height,dst,src,ms,gb_per_sec,cycles_per_pixel\n");
+        }
+    }
+    ~BenchWriter() { if (m_file) { fclose(m_file); } }
+
+    // bytes: bytes read + written per run
+    void write(const char *op, const char *isa, const BenchResolution& res, const std::string& dst, const std::string& src,
+        size_t bytes, const BenchResult& r)
+    {
+        double pixels = double(res.width) * res.height;
+        double gbps = double(bytes) / (r.ms * 1e6);
+        if (m_file) {
+            fprintf(m_file, "%s,%s,%s,%d,%d,%s,%s,%.4f,%.3f,%.3f\n",
+                op, isa, res.name, res.width, res.height, dst.c_str(), src.c_str(), r.ms, gbps, r.cycles / pixels);
+        }
+    }
+
+private:
+    FILE *m_file;
+};
+
+} // namespace
+
+
+void ConvertBench()
+{
+    printf("ConvertBench begin\n");
+
+    const int num_isas = fcGetNumConvertKernelISAs(); // scalar and each ISPC target this CPU supports
+    const size_t MaxPixelSize = 16; // RGBAf32 / RGBAi32
+    const BenchResolution& max_res = Resolutions[sizeof(Resolutions) / sizeof(Resolutions[0]) - 1];
+    size_t max_pixels = size_t(max_res.width) * max_res.height;
+
+    TBuffer<RGBAf32> source(max_pixels);
+    Buffer src(max_pixels * MaxPixelSize), dst(max_pixels * MaxPixelSize);
+    memset(&dst[0], 0, dst.size());
+
+    BenchWriter writer("ConvertBench.csv");
+    for (auto& res : Resolutions) {
+        size_t num_pixels = size_t(res.width) * res.height;
+        CreateVideoData(&source[0], res.width, res.height, 0);
+
+        std::vector<double> total_cycles(num_isas), total_ms(num_isas);
+        for (fcPixelFormat srcfmt : Formats) {
+            if (srcfmt == fcPixelFormat_RGBAf32) {
+                memcpy(&src[0], &source[0], num_pixels * sizeof(RGBAf32));
+            }
+            else {
+                fcConvertPixelFormat(&src[0], srcfmt, &source[0], fcPixelFormat_RGBAf32, num_pixels);
+            }
+
+            for (fcPixelFormat dstfmt : Formats) {
+                if (dstfmt == srcfmt) { continue; }
+                size_t bytes = num_pixels * (fcGetPixelSize(srcfmt) + fcGetPixelSize(dstfmt));
+
+                for (int isa = 0; isa < num_isas; ++isa) {
+                    auto r = Measure([&]() { fcConvertPixelFormat_ISA(isa, &dst[0], dstfmt, &src[0], srcfmt, num_pixels); });
+                    writer.write("convert", fcGetConvertKernelISAName(isa), res, GetFormatName(dstfmt), GetFormatName(srcfmt), bytes, r);
+                    total_ms[isa] += r.ms; total_cycles[isa] += r.cycles;
+                }
+            }
+
+            // flip reads and writes every row twice (swap through a row buffer)
+            auto flip = Measure([&]() { fcImageFlipY(&src[0], res.width, res.height, srcfmt); });
+            writer.write("flip_y", "c++", res, GetFormatName(srcfmt), GetFormatName(srcfmt), num_pixels * fcGetPixelSize(srcfmt) * 2, flip);
+        }
+
+        // scale RGBA elements of each type in place
+        size_t num_elements = num_pixels * 4;
+        for (int isa = 0; isa < num_isas; ++isa) {
+            auto scale = [&](const char *type, size_t element_size, BenchResult r) {
+                writer.write("scale", fcGetConvertKernelISAName(isa), res, type, type, num_elements * element_size * 2, r);
+            };
+            scale("u8", 1, Measure([&]() { fcScaleArray_ISA(isa, (uint8_t*)&dst[0], num_elements, 1.0f); }));
+            scale("i16", 2, Measure([&]() { fcScaleArray_ISA(isa, (uint16_t*)&dst[0], num_elements, 1.0f); }));
+            scale("i32", 4, Measure([&]() { fcScaleArray_ISA(isa, (int32_t*)&dst[0], num_elements, 1.0f); }));
+            scale("f16", 2, Measure([&]() { fcScaleArray_ISA(isa, (half*)&dst[0], num_elements, 1.0f); }));
+            scale("f32", 4, Measure([&]() { fcScaleArray_ISA(isa, (float*)&dst[0], num_elements, 1.0f); }));
+        }
+
+        int num_pairs = NumFormats * (NumFormats - 1);
+        printf("  %s: all pairs avg\n", res.name);
+        for (int isa = 0; isa < num_isas; ++isa) {
+            printf("    %-10s %.3f ms (%.2f cycles/pixel), x%.2f\n",
+                fcGetConvertKernelISAName(isa), total_ms[isa] / num_pairs, total_cycles[isa] / num_pairs / num_pixels,
+                total_ms[0] / total_ms[isa]);
+        }
+    }
+    printf("  results are written to ConvertBench.csv\n");
+
+    printf("ConvertBench end\n");
+}
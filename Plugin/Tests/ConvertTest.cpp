@@ -1,6 +1,13 @@
 #include "TestCommon.h"
 
 const void* fcConvertPixelFormat(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+void fcConvertPixelFormatImage(void *dst, fcPixelFormat dstfmt, int dst_pitch, const void *src, fcPixelFormat srcfmt, int src_pitch,
+    int width, int height, bool flip_y);
+void fcImageFlipY(void *image_, int width, int height, fcPixelFormat fmt);
+int fcGetPixelSize(fcPixelFormat format);
+const void* fcConvertPixelFormatParallel(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+const void* fcConvertPixelFormat_Scalar(void *dst, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt, size_t size);
+const char* fcGetConvertKernelTarget();
 
 const int Width = 320;
 const int Height = 240;
@@ -18,6 +25,161 @@ void ConvertTestImpl(fcIPngContext *ctx, TBuffer<Src>& src)
     fcPngExportPixels(ctx, filename, data, Width, Height, GetPixelFormat<Dst>::value);
 }
 
+// fused convert + flip + pitch must give the same result as convert, then flip.
+template<class Src, class Dst>
+bool ConvertImageTestImpl(TBuffer<Src>& src)
+{
+    auto srcfmt = GetPixelFormat<Src>::value;
+    auto dstfmt = GetPixelFormat<Dst>::value;
+
+    TBuffer<Dst> expected(Width * Height);
+    auto data = fcConvertPixelFormat(&expected[0], dstfmt, &src[0], srcfmt, src.size());
+    if (data != &expected[0]) { memcpy(&expected[0], data, expected.size() * sizeof(Dst)); }
+    fcImageFlipY(&expected[0], Width, Height, dstfmt);
+
+    // padded rows on both sides
+    int src_pitch = Width * sizeof(Src) + 12;
+    int dst_pitch = Width * sizeof(Dst) + 20;
+    Buffer padded_src(src_pitch * Height);
+    for (int y = 0; y < Height; ++y) {
+        memcpy(&padded_src[src_pitch * y], &src[Width * y], Width * sizeof(Src));
+    }
+    Buffer padded_dst(dst_pitch * Height);
+    fcConvertPixelFormatImage(&padded_dst[0], dstfmt, dst_pitch, &padded_src[0], srcfmt, src_pitch, Width, Height, true);
+
+    for (int y = 0; y < Height; ++y) {
+        if (memcmp(&padded_dst[dst_pitch * y], &expected[Width * y], Width * sizeof(Dst)) != 0) { return false; }
+    }
+    return true;
+}
+
+// convert 4K RGBAf16 to RGBAi16 (what png export does) and flip. two passes vs fused.
+static void ConvertImageBench()
+{
+    const int W = 3840, H = 2160, N = 10;
+    Buffer src(W * H * fcGetPixelSize(fcPixelFormat_RGBAf16));
+    Buffer dst(W * H * fcGetPixelSize(fcPixelFormat_RGBAi16));
+    memset(&src[0], 0, src.size());
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; ++i) {
+        fcConvertPixelFormat(&dst[0], fcPixelFormat_RGBAi16, &src[0], fcPixelFormat_RGBAf16, W * H);
+        fcImageFlipY(&dst[0], W, H, fcPixelFormat_RGBAi16);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; ++i) {
+        fcConvertPixelFormatImage(&dst[0], fcPixelFormat_RGBAi16, 0, &src[0], fcPixelFormat_RGBAf16, 0, W, H, true);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    printf("  4K RGBAf16 -> RGBAi16 + flip: convert then flip %.2f ms, fused %.2f ms\n",
+        std::chrono::duration<double, std::milli>(mid - begin).count() / N,
+        std::chrono::duration<double, std::milli>(end - mid).count() / N);
+}
+
+// 4K RGBAf32 -> RGBAu8 (mp4 capture of float render targets). serial vs parallel vs async.
+static void ConvertParallelTest()
+{
+    const int W = 3840, H = 2160, N = 10;
+    TBuffer<RGBAf32> src(W * H);
+    CreateVideoData(&src[0], W, H, 0);
+    TBuffer<RGBAu8> expected(W * H), dst(W * H);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; ++i) {
+        fcConvertPixelFormat(&expected[0], fcPixelFormat_RGBAu8, &src[0], fcPixelFormat_RGBAf32, W * H);
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    for (int i = 0; i < N; ++i) {
+        fcConvertPixelFormatParallel(&dst[0], fcPixelFormat_RGBAu8, &src[0], fcPixelFormat_RGBAf32, W * H);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    bool parallel_ok = memcmp(&dst[0], &expected[0], dst.size() * sizeof(RGBAu8)) == 0;
+
+    memset(&dst[0], 0, dst.size() * sizeof(RGBAu8));
+    auto t3 = std::chrono::steady_clock::now();
+    fcJob *job = fcConvertPixelFormatAsync(&dst[0], fcPixelFormat_RGBAu8, &src[0], fcPixelFormat_RGBAf32, W * H);
+    auto t4 = std::chrono::steady_clock::now();
+    bool async_ok = fcJobWait(job) == fcJobState_Succeeded && memcmp(&dst[0], &expected[0], dst.size() * sizeof(RGBAu8)) == 0;
+    fcJobRelease(job);
+
+    auto ms = [](std::chrono::steady_clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    printf("  4K RGBAf32 -> RGBAu8: serial %.2f ms, parallel %.2f ms (%s), async call returned in %.3f ms (%s)\n",
+        ms(t1 - t0) / N, ms(t2 - t1) / N, parallel_ok ? "ok" : "failed", ms(t4 - t3), async_ok ? "ok" : "failed");
+}
+
+// the kernels for this CPU (ISPC) vs the portable C++ kernels. results must match (f16 by 1 ulp) for all pairs.
+// also every pair must be converted (dst written), and non-pixel formats rejected.
+static void ConvertKernelTargetTest()
+{
+    const fcPixelFormat formats[] = {
+        fcPixelFormat_RGBAu8, fcPixelFormat_RGBu8, fcPixelFormat_RGu8, fcPixelFormat_Ru8,
+        fcPixelFormat_RGBAi16, fcPixelFormat_RGBi16, fcPixelFormat_RGi16, fcPixelFormat_Ri16,
+        fcPixelFormat_RGBAi32, fcPixelFormat_RGBi32, fcPixelFormat_RGi32, fcPixelFormat_Ri32,
+        fcPixelFormat_RGBAf16, fcPixelFormat_RGBf16, fcPixelFormat_RGf16, fcPixelFormat_Rf16,
+        fcPixelFormat_RGBAf32, fcPixelFormat_RGBf32, fcPixelFormat_RGf32, fcPixelFormat_Rf32,
+    };
+    const int num_pixels = Width * Height;
+    TBuffer<RGBAf32> video_frame(num_pixels);
+    CreateVideoData(&video_frame[0], Width, Height, 0);
+    Buffer src(num_pixels * 16), expected(num_pixels * 16), dst(num_pixels * 16);
+
+    int num_failed = 0;
+    for (fcPixelFormat srcfmt : formats) {
+        // not fcConvertPixelFormat(): it returns the source as is without writing src when srcfmt is RGBAf32
+        fcConvertPixelFormatImage(&src[0], srcfmt, 0, &video_frame[0], fcPixelFormat_RGBAf32, 0, Width, Height, false);
+        for (fcPixelFormat dstfmt : formats) {
+            if (dstfmt == srcfmt) { continue; }
+            size_t dst_size = num_pixels * fcGetPixelSize(dstfmt);
+            memset(&expected[0], 0xcd, dst_size);
+            memset(&dst[0], 0xcd, dst_size);
+            fcConvertPixelFormat_Scalar(&expected[0], dstfmt, &src[0], srcfmt, num_pixels);
+            bool ok = fcConvertPixelFormat(&dst[0], dstfmt, &src[0], srcfmt, num_pixels) == &dst[0];
+            ok = ok && std::any_of(&dst[0], &dst[0] + dst_size, [](char c) { return c != (char)0xcd; });
+
+            if ((dstfmt & fcPixelFormat_TypeMask) == fcPixelFormat_Type_f16) {
+                auto *e = (const int16_t*)&expected[0];
+                auto *d = (const int16_t*)&dst[0];
+                for (size_t i = 0; i < dst_size / 2 && ok; ++i) { ok = std::abs(e[i] - d[i]) <= 1; }
+            }
+            else {
+                ok = ok && memcmp(&expected[0], &dst[0], dst_size) == 0;
+            }
+            if (!ok) {
+                printf("  kernel mismatch: %x -> %x\n", srcfmt, dstfmt);
+                ++num_failed;
+            }
+        }
+    }
+    if (fcConvertPixelFormat(&dst[0], fcPixelFormat_RGBAu8, &src[0], fcPixelFormat_I420, num_pixels) != nullptr) {
+        printf("  I420 -> RGBAu8 is not rejected\n");
+        ++num_failed;
+    }
+    printf("  %s kernels vs scalar kernels: %s\n", fcGetConvertKernelTarget(), num_failed == 0 ? "ok" : "failed");
+
+    // 4K conversions done by capture (float render targets to mp4 and png)
+    const int W = 3840, H = 2160, N = 10;
+    TBuffer<RGBAf32> src4k(W * H);
+    CreateVideoData(&src4k[0], W, H, 0);
+    Buffer src16(W * H * 8), dst4k(W * H * 8);
+    fcConvertPixelFormat(&src16[0], fcPixelFormat_RGBAf16, &src4k[0], fcPixelFormat_RGBAf32, W * H);
+
+    auto bench = [&](const char *name, fcPixelFormat dstfmt, const void *src, fcPixelFormat srcfmt) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < N; ++i) { fcConvertPixelFormat_Scalar(&dst4k[0], dstfmt, src, srcfmt, W * H); }
+        auto t1 = std::chrono::steady_clock::now();
+        for (int i = 0; i < N; ++i) { fcConvertPixelFormat(&dst4k[0], dstfmt, src, srcfmt, W * H); }
+        auto t2 = std::chrono::steady_clock::now();
+
+        double scalar = std::chrono::duration<double, std::milli>(t1 - t0).count() / N;
+        double target = std::chrono::duration<double, std::milli>(t2 - t1).count() / N;
+        printf("  4K %s: scalar %.2f ms, %s %.2f ms (x%.2f)\n", name, scalar, fcGetConvertKernelTarget(), target, scalar / target);
+    };
+    bench("RGBAf32 -> RGBAu8", fcPixelFormat_RGBAu8, &src4k[0], fcPixelFormat_RGBAf32);
+    bench("RGBAf32 -> RGBAf16", fcPixelFormat_RGBAf16, &src4k[0], fcPixelFormat_RGBAf32);
+    bench("RGBAf16 -> RGBAi16", fcPixelFormat_RGBAi16, &src16[0], fcPixelFormat_RGBAf16);
+}
+
 void ConvertTest()
 {
     printf("ConvertTest begin\n");
@@ -58,6 +220,31 @@ void ConvertTest()
 
     fcPngDestroyContext(ctx);
 
+    {
+        int num_failed = 0;
+#define ImageTestCases(SrcT)\
+{\
+    TBuffer<SrcT> video_frame(Width * Height);\
+    CreateVideoData(&video_frame[0], Width, Height, 0);\
+    if (!ConvertImageTestImpl<SrcT, RGBAu8>(video_frame)) { ++num_failed; }\
+    if (!ConvertImageTestImpl<SrcT, RGBu8>(video_frame)) { ++num_failed; }\
+    if (!ConvertImageTestImpl<SrcT, RGBAf16>(video_frame)) { ++num_failed; }\
+    if (!ConvertImageTestImpl<SrcT, RGf16>(video_frame)) { ++num_failed; }\
+    if (!ConvertImageTestImpl<SrcT, Rf32>(video_frame)) { ++num_failed; }\
+}
+        ImageTestCases(RGBAu8);
+        ImageTestCases(RGBu8);
+        ImageTestCases(RGBAf16);
+        ImageTestCases(RGf16);
+        ImageTestCases(RGBAf32);
+        ImageTestCases(Rf32);
+#undef ImageTestCases
+        printf("  fused convert + flip: %s\n", num_failed == 0 ? "ok" : "failed");
+    }
+    ConvertImageBench();
+    ConvertParallelTest();
+    ConvertKernelTargetTest();
+
     printf("ConvertTest end\n");
 
 }
@@ -40,6 +40,7 @@ void MP4Test()
     // create output streams
     fcStream* fstream = fcCreateFileStream("file_stream.mp4");
     fcStream* mstream = fcCreateMemoryStream();
+    fcStream* sstream = fcCreateSegmentedMemoryStream(64 * 1024); // small segments to patch headers across boundaries
     FILE *ofile = fopen("custom_stream.mp4", "wb");
     fcStream* cstream = fcCreateCustomStream(ofile, &tellp, &seekp, &write);
 
@@ -47,6 +48,7 @@ void MP4Test()
     fcIMP4Context *ctx = fcMP4CreateContext(&conf);
     fcMP4AddOutputStream(ctx, fstream);
     fcMP4AddOutputStream(ctx, mstream);
+    fcMP4AddOutputStream(ctx, sstream);
     fcMP4AddOutputStream(ctx, cstream);
 
     // create movie data
@@ -87,8 +89,17 @@ void MP4Test()
         std::fstream of("memory_stream.mp4", std::ios::binary | std::ios::out);
         of.write((char*)bd.data, bd.size);
     }
+    {
+        std::fstream of("segmented_stream.mp4", std::ios::binary | std::ios::out);
+        int n = fcStreamGetNumSegments(sstream);
+        for (int i = 0; i < n; ++i) {
+            fcBufferData bd = fcStreamGetSegment(sstream, i);
+            of.write((char*)bd.data, bd.size);
+        }
+    }
     fcDestroyStream(fstream);
     fcDestroyStream(mstream);
+    fcDestroyStream(sstream);
     fcDestroyStream(cstream);
     fclose(ofile);
 
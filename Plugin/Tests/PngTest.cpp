@@ -1,4 +1,70 @@
 #include "TestCommon.h"
+#include <libpng/png.h>
+#ifdef _WIN32
+    #pragma comment(lib, "libpng16_static.lib")
+    #pragma comment(lib, "zlibstatic.lib")
+#endif
+
+// decode a png file with libpng (zlib's inflate, crc and adler-32 checks). dst receives the rows as stored in the file.
+static bool PngDecodeFile(const char *path, std::string& dst, int& width, int& height)
+{
+    std::string file;
+    {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin) { return false; }
+        file.assign(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+    }
+
+    struct Reader { const std::string *src; size_t pos; } reader = { &file, 0 };
+    std::vector<png_bytep> rows;
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return false;
+    }
+    png_set_read_fn(png_ptr, &reader, [](png_structp png_ptr, png_bytep data, png_size_t size) {
+        auto *r = (Reader*)png_get_io_ptr(png_ptr);
+        if (r->pos + size > r->src->size()) { png_error(png_ptr, "unexpected end of file"); }
+        memcpy(data, &(*r->src)[r->pos], size);
+        r->pos += size;
+    });
+    png_read_info(png_ptr, info_ptr);
+    width = (int)png_get_image_width(png_ptr, info_ptr);
+    height = (int)png_get_image_height(png_ptr, info_ptr);
+    size_t pitch = png_get_rowbytes(png_ptr, info_ptr);
+    dst.resize(pitch * height);
+    rows.resize(height);
+    for (int i = 0; i < height; ++i) { rows[i] = (png_bytep)&dst[pitch * i]; }
+    png_read_image(png_ptr, &rows[0]);
+    png_read_end(png_ptr, nullptr);
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return true;
+}
+
+// true if both files decode to the same image
+static bool PngCompareFiles(const char *path1, const char *path2)
+{
+    std::string pixels1, pixels2;
+    int width1, height1, width2, height2;
+    return PngDecodeFile(path1, pixels1, width1, height1) && PngDecodeFile(path2, pixels2, width2, height2) &&
+        width1 == width2 && height1 == height2 && pixels1 == pixels2;
+}
+
+// gradients, shading and noise: closer to a rendered scene than CreateVideoData(), which is what captures mostly are
+static void CreateSceneData(RGBAu8 *dst, int width, int height)
+{
+    uint32_t seed = 1;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; // xorshift
+            int noise = int(seed % 9) - 4;
+            float shade = 0.5f + 0.5f * std::sin(x * 0.01f) * std::cos(y * 0.013f);
+            auto c = [&](float v) { return (u8)std::min(std::max(int(v * shade * 255.0f) + noise, 0), 255); };
+            dst[y * width + x] = RGBAu8(c(float(x) / width), c(float(y) / height), c(0.6f), 255);
+        }
+    }
+}
 
 template<class T>
 void PngTestImpl(fcIPngContext *ctx, const char *filename, bool flipY=false)
@@ -28,5 +94,245 @@ void PngTest()
 
     fcPngDestroyContext(ctx);
 
+    // non-blocking mode: exports fail instead of waiting when all slots are in use
+    {
+        fcPngConfig nb_conf;
+        nb_conf.max_active_tasks = 1;
+        nb_conf.non_blocking = true;
+        fcIPngContext *nb_ctx = fcPngCreateContext(&nb_conf);
+
+        const int Width = 1920;
+        const int Height = 1080;
+        TBuffer<RGBAu8> frame(Width * Height);
+        CreateVideoData(&frame[0], Width, Height, 0);
+
+        int num_rejected = 0;
+        for (int i = 0; i < 8; ++i) {
+            if (!fcPngExportPixels(nb_ctx, "NonBlocking.png", &frame[0], Width, Height, fcPixelFormat_RGBAu8)) {
+                ++num_rejected;
+            }
+        }
+        printf("  non-blocking: %d / 8 rejected, %d slot(s) in use\n", num_rejected, fcPngGetActiveTaskCount(nb_ctx));
+        fcPngDestroyContext(nb_ctx);
+    }
+
+    // async export: the callback is called from a worker and the handle reports the result
+    {
+        fcPngConfig async_conf;
+        fcIPngContext *async_ctx = fcPngCreateContext(&async_conf);
+
+        const int Width = 320;
+        const int Height = 240;
+        TBuffer<RGBAu8> frame(Width * Height);
+        CreateVideoData(&frame[0], Width, Height, 0);
+
+        std::atomic_int num_callbacks(0);
+        auto cb = [](fcJob *job, fcJobState state, void *userdata) {
+            if (state == fcJobState_Succeeded) { ++*(std::atomic_int*)userdata; }
+        };
+        fcJob *job = fcPngExportPixelsAsync(async_ctx, "Async.png", &frame[0], Width, Height, fcPixelFormat_RGBAu8, false, cb, &num_callbacks);
+        fcJobState state = fcJobWait(job);
+        printf("  async: %s\n", state == fcJobState_Succeeded && fcJobPoll(job) == state && num_callbacks == 1 ? "ok" : "failed");
+        fcJobRelease(job);
+        fcPngDestroyContext(async_ctx);
+    }
+
+    // stream and callback outputs: same data as the file. exports to one stream are written whole, one after another
+    {
+        const int Width = 320;
+        const int Height = 240;
+        TBuffer<RGBAu8> frame(Width * Height);
+        CreateVideoData(&frame[0], Width, Height, 0);
+
+        fcPngConfig stream_conf;
+        fcIPngContext *stream_ctx = fcPngCreateContext(&stream_conf);
+        fcStream *mstream = fcCreateMemoryStream();
+        std::string from_cb, from_custom;
+        auto data_cb = [](const void *data, size_t size, void *userdata) {
+            ((std::string*)userdata)->append((const char*)data, size);
+        };
+        // custom streams buffer writes. the export must flush them, without fcStreamFlush() by the caller
+        auto custom_tellp = [](void *obj) -> size_t { return ((std::string*)obj)->size(); };
+        auto custom_seekp = [](void*, size_t) {};
+        auto custom_write = [](void *obj, const void *data, size_t size) -> size_t {
+            ((std::string*)obj)->append((const char*)data, size);
+            return size;
+        };
+        fcStream *cstream = fcCreateCustomStream(&from_custom, custom_tellp, custom_seekp, custom_write);
+        fcPngExportPixels(stream_ctx, "Stream.png", &frame[0], Width, Height, fcPixelFormat_RGBAu8);
+        fcPngExportPixelsToStream(stream_ctx, mstream, &frame[0], Width, Height, fcPixelFormat_RGBAu8);
+        fcPngExportPixelsToStream(stream_ctx, mstream, &frame[0], Width, Height, fcPixelFormat_RGBAu8);
+        fcPngExportPixelsToCallback(stream_ctx, data_cb, &from_cb, &frame[0], Width, Height, fcPixelFormat_RGBAu8);
+        fcPngExportPixelsToStream(stream_ctx, cstream, &frame[0], Width, Height, fcPixelFormat_RGBAu8);
+        fcPngDestroyContext(stream_ctx); // waits the exports
+
+        std::ifstream fin("Stream.png", std::ios::binary);
+        std::string from_file((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        fcBufferData mdata = fcStreamGetBufferData(mstream);
+        std::string from_stream((const char*)mdata.data, mdata.size);
+        bool ok = !from_file.empty() && from_cb == from_file && from_stream == from_file + from_file && from_custom == from_file;
+        printf("  stream / callback: %s (%d bytes)\n", ok ? "ok" : "failed", (int)from_file.size());
+        fcDestroyStream(mstream);
+        fcDestroyStream(cstream);
+    }
+
+    // exports without a destination fail up front and don't take a slot
+    {
+        fcPngConfig nodst_conf;
+        fcIPngContext *nodst_ctx = fcPngCreateContext(&nodst_conf);
+        RGBAu8 pixel;
+        bool ok = !fcPngExportPixels(nodst_ctx, nullptr, &pixel, 1, 1, fcPixelFormat_RGBAu8) &&
+            !fcPngExportPixels(nodst_ctx, "", &pixel, 1, 1, fcPixelFormat_RGBAu8) &&
+            fcPngGetActiveTaskCount(nodst_ctx) == 0;
+        printf("  no destination: %s\n", ok ? "ok" : "failed");
+        fcPngDestroyContext(nodst_ctx);
+    }
+
+    // sequence: encoder state and buffers of finished exports are reused by later ones. every frame must come out the same
+    {
+        const int Width = 1920;
+        const int Height = 1080;
+        const int NumFrames = 16;
+        TBuffer<RGBAf16> frame(Width * Height);
+        CreateVideoData(&frame[0], Width, Height, 0);
+
+        for (int parallel = 0; parallel < 2; ++parallel) {
+            fcPngConfig seq_conf;
+            seq_conf.max_active_tasks = 2;
+            seq_conf.parallel_encoding = parallel != 0;
+            fcIPngContext *seq_ctx = fcPngCreateContext(&seq_conf);
+
+            std::string results[NumFrames];
+            auto data_cb = [](const void *data, size_t size, void *userdata) {
+                ((std::string*)userdata)->assign((const char*)data, size);
+            };
+            auto begin = std::chrono::steady_clock::now();
+            for (int i = 0; i < NumFrames; ++i) {
+                fcPngExportPixelsToCallback(seq_ctx, data_cb, &results[i], &frame[0], Width, Height, fcPixelFormat_RGBAf16);
+            }
+            fcPngDestroyContext(seq_ctx); // waits the exports
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+            bool ok = !results[0].empty();
+            for (auto& r : results) { ok = ok && r == results[0]; }
+            printf("  sequence (%s): %s, %.2f ms / frame\n", parallel ? "parallel" : "serial", ok ? "ok" : "failed", ms / NumFrames);
+        }
+    }
+
+    // parallel encoding: 4K 16 bit png, one task vs strips. both files must have the same image
+    {
+        const int Width = 3840;
+        const int Height = 2160;
+        TBuffer<RGBAf16> frame(Width * Height);
+        CreateVideoData(&frame[0], Width, Height, 0);
+
+        auto export_png = [&](const char *path, bool parallel) {
+            fcPngConfig par_conf;
+            par_conf.parallel_encoding = parallel;
+            fcIPngContext *par_ctx = fcPngCreateContext(&par_conf);
+            auto begin = std::chrono::steady_clock::now();
+            fcPngExportPixels(par_ctx, path, &frame[0], Width, Height, fcPixelFormat_RGBAf16);
+            fcPngDestroyContext(par_ctx); // waits the export
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        };
+        double serial = export_png("Serial_4K.png", false);
+        double parallel = export_png("Parallel_4K.png", true);
+        printf("  4K RGBAf16: serial %.2f ms, parallel %.2f ms (%s)\n", serial, parallel,
+            PngCompareFiles("Serial_4K.png", "Parallel_4K.png") ? "ok" : "failed");
+    }
+
+    // fast backend: files must decode (with libpng / zlib) to the same image as the zlib backend's.
+    // single strip and strips, stored blocks (noise) and huffman blocks of more than 64K symbols (scene)
+    {
+        const int Width = 1920;
+        const int Height = 1080;
+        TBuffer<RGBAu8> stripes(Width * Height), scene(Width * Height), noise(Width * Height);
+        CreateVideoData(&stripes[0], Width, Height, 0);
+        CreateSceneData(&scene[0], Width, Height);
+        uint32_t seed = 1;
+        for (auto& p : noise) {
+            seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; // xorshift
+            p = RGBAu8(u8(seed), u8(seed >> 8), u8(seed >> 16), u8(seed >> 24));
+        }
+        TBuffer<RGBAf16> stripes16(Width * Height);
+        CreateVideoData(&stripes16[0], Width, Height, 0);
+
+        struct { const char *name; const void *pixels; int width, height; fcPixelFormat format; } images[] = {
+            { "small", &stripes[0], 320, 240, fcPixelFormat_RGBAu8 },
+            { "stripes", &stripes[0], Width, Height, fcPixelFormat_RGBAu8 },
+            { "stripes16", &stripes16[0], Width, Height, fcPixelFormat_RGBAf16 },
+            { "scene", &scene[0], Width, Height, fcPixelFormat_RGBAu8 },
+            { "noise", &noise[0], Width, Height, fcPixelFormat_RGBAu8 },
+        };
+        for (auto& image : images) {
+            for (int parallel = 0; parallel < 2; ++parallel) {
+                char zlib_path[256], fast_path[256];
+                sprintf(zlib_path, "Backend_%s_%d_zlib.png", image.name, parallel);
+                sprintf(fast_path, "Backend_%s_%d_fast.png", image.name, parallel);
+                for (int backend = 0; backend < 2; ++backend) {
+                    fcPngConfig backend_conf;
+                    backend_conf.backend = backend ? fcPngBackend_Fast : fcPngBackend_Zlib;
+                    backend_conf.parallel_encoding = parallel != 0;
+                    fcIPngContext *backend_ctx = fcPngCreateContext(&backend_conf);
+                    fcPngExportPixels(backend_ctx, backend ? fast_path : zlib_path, image.pixels, image.width, image.height, image.format);
+                    fcPngDestroyContext(backend_ctx); // waits the export
+                }
+                printf("  fast backend round trip (%s, %s): %s\n", image.name, parallel ? "strips" : "single strip",
+                    PngCompareFiles(zlib_path, fast_path) ? "ok" : "failed");
+            }
+        }
+    }
+
+    // presets and backends: throughput and compression ratio. the stripes of CreateVideoData() and CreateSceneData()
+    {
+        const int Width = 1920;
+        const int Height = 1080;
+        const int NumFrames = 4;
+        TBuffer<RGBAu8> stripes(Width * Height), scene(Width * Height);
+        CreateVideoData(&stripes[0], Width, Height, 0);
+        CreateSceneData(&scene[0], Width, Height);
+
+        struct { const char *name; fcPngPreset preset; fcPngBackend backend; } presets[] = {
+            { "balanced", fcPngPreset_Balanced, fcPngBackend_Zlib }, // baseline of speedups
+            { "fastest", fcPngPreset_Fastest, fcPngBackend_Zlib },
+            { "smallest", fcPngPreset_Smallest, fcPngBackend_Zlib },
+            { "fast backend, balanced filters", fcPngPreset_Balanced, fcPngBackend_Fast },
+            { "fast backend, fastest filters", fcPngPreset_Fastest, fcPngBackend_Fast },
+        };
+        struct { const char *name; const RGBAu8 *pixels; } images[] = {
+            { "stripes", &stripes[0] },
+            { "scene", &scene[0] },
+        };
+        const double raw_size = double(Width * Height * sizeof(RGBAu8));
+        for (auto& image : images) {
+            double baseline = 0.0;
+            for (auto& preset : presets) {
+                fcPngConfig preset_conf;
+                preset_conf.preset = preset.preset;
+                preset_conf.backend = preset.backend;
+                fcIPngContext *preset_ctx = fcPngCreateContext(&preset_conf);
+
+                char path[256];
+                auto begin = std::chrono::steady_clock::now();
+                for (int i = 0; i < NumFrames; ++i) {
+                    sprintf(path, "Preset_%s_%d_%d_%d.png", image.name, preset.preset, preset.backend, i);
+                    fcPngExportPixels(preset_ctx, path, image.pixels, Width, Height, fcPixelFormat_RGBAu8);
+                }
+                fcPngDestroyContext(preset_ctx); // waits the exports
+                double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+                long file_size = 0;
+                if (FILE *f = fopen(path, "rb")) {
+                    fseek(f, 0, SEEK_END);
+                    file_size = ftell(f);
+                    fclose(f);
+                }
+                if (baseline == 0.0) { baseline = sec; }
+                printf("  preset %s (%s): %.1f MB/s, ratio %.2f, x%.2f\n", preset.name, image.name,
+                    raw_size * NumFrames / sec / 1000000.0, file_size > 0 ? raw_size / file_size : 0.0, baseline / sec);
+            }
+        }
+    }
+
     printf("PngTest end\n");
 }
@@ -0,0 +1,241 @@
+#include "TestCommon.h"
+#include <functional>
+
+
+// box / brand type: the 4 chars as a big endian value, as the mp4 muxer writes them
+static uint32_t FourCC(const char (&s)[5])
+{
+    return (uint32_t((uint8_t)s[0]) << 24) | (uint32_t((uint8_t)s[1]) << 16) | (uint32_t((uint8_t)s[2]) << 8) | uint32_t((uint8_t)s[3]);
+}
+
+// emulate the write pattern of fcMP4StreamWriter: frames with tellp() for each, then the moov box made of
+// many small writes in nested boxes whose sizes are patched by seekp(), then the mdat size patch.
+static void MuxLikeWrite(BinaryStream &os, int num_frames, const std::vector<char> &payload)
+{
+    auto box = [&os](uint32_t name, const std::function<void()> &f) {
+        size_t offset = os.tellp();
+        os << uint32_t(0) << name;
+        f();
+        size_t pos = os.tellp();
+        os.seekp(offset);
+        os << uint32_t(pos - offset);
+        os.seekp(pos);
+    };
+
+    os << uint32_t(0x18) << FourCC("ftyp") << FourCC("mp42") << uint32_t(0) << FourCC("mp42") << FourCC("isom");
+    size_t mdat_begin = os.tellp();
+    os << uint32_t(1) << FourCC("mdat") << uint64_t(0);
+
+    std::vector<uint64_t> offsets;
+    for (int i = 0; i < num_frames; ++i) {
+        offsets.push_back(os.tellp());
+        size_t size = payload.size() - (i % 7) * 1000; // vary frame sizes
+        os << uint32_t(size);
+        os.write(&payload[0], size);
+    }
+    size_t mdat_end = os.tellp();
+
+    box(FourCC("moov"), [&]() {
+        box(FourCC("trak"), [&]() {
+            box(FourCC("stsz"), [&]() {
+                for (int i = 0; i < num_frames; ++i) { os << uint32_t(i); }
+            });
+            box(FourCC("stco"), [&]() {
+                for (auto o : offsets) { os << uint32_t(o); }
+            });
+            box(FourCC("stts"), [&]() {
+                for (int i = 0; i < num_frames; ++i) { os << uint32_t(1) << uint32_t(33); }
+            });
+        });
+    });
+
+    size_t pos = os.tellp();
+    os.seekp(mdat_begin + 8);
+    os << uint64_t(mdat_end - mdat_begin);
+    os.seekp(pos);
+}
+
+static double MuxBenchImpl(BinaryStream &os, int num_frames, const std::vector<char> &payload)
+{
+    auto begin = std::chrono::steady_clock::now();
+    MuxLikeWrite(os, num_frames, payload);
+    os.flush(); // buffered / pending writes are part of the cost
+    auto end = std::chrono::steady_clock::now();
+    return double(os.tellp()) / std::chrono::duration<double>(end - begin).count();
+}
+
+// callee of custom streams. counts callback calls.
+struct CustomStreamHost
+{
+    Buffer buf;
+    size_t pos;
+    int num_calls;
+
+    CustomStreamHost() : pos(), num_calls() {}
+
+    static size_t tellp(void *obj) { return ((CustomStreamHost*)obj)->pos; }
+    static void seekp(void *obj, size_t pos)
+    {
+        auto *h = (CustomStreamHost*)obj;
+        h->pos = pos;
+        ++h->num_calls;
+    }
+    static size_t write(void *obj, const void *data, size_t len)
+    {
+        auto *h = (CustomStreamHost*)obj;
+        if (h->buf.size() < h->pos + len) { h->buf.resize(h->pos + len); }
+        memcpy(h->buf.ptr() + h->pos, data, len);
+        h->pos += len;
+        ++h->num_calls;
+        return len;
+    }
+    static size_t writev(void *obj, const fcBufferData *buffers, int num_buffers)
+    {
+        auto *h = (CustomStreamHost*)obj;
+        size_t total = 0;
+        for (int i = 0; i < num_buffers; ++i) {
+            total += write(obj, buffers[i].data, buffers[i].size);
+            --h->num_calls;
+        }
+        ++h->num_calls;
+        return total;
+    }
+};
+
+static bool CompareFile(const char *path, const Buffer &expected)
+{
+    std::ifstream is(path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    return data.size() == expected.size() && memcmp(&data[0], expected.ptr(), data.size()) == 0;
+}
+
+void StreamTest()
+{
+    printf("StreamTest begin\n");
+
+    const int NumFrames = 3000;
+    std::vector<char> payload(32 * 1024);
+    for (size_t i = 0; i < payload.size(); ++i) { payload[i] = (char)i; }
+
+    // FileStream must write the same data as BufferStream. small buffer to exercise both coalesced and direct patches.
+    Buffer expected;
+    {
+        BufferStream bs(expected);
+        MuxLikeWrite(bs, 100, payload);
+    }
+    {
+        {
+            FileStream fs("FileStream.bin", 4096);
+            MuxLikeWrite(fs, 100, payload);
+        }
+        printf("  FileStream: %s\n", CompareFile("FileStream.bin", expected) ? "ok" : "failed");
+    }
+    // small blocks and budget to exercise recycling, throttling and patches to pending ranges
+    for (int io_uring = 0; io_uring < 2; ++io_uring) {
+        bool using_io_uring;
+        {
+            AsyncFileStream fs("AsyncFileStream.bin", 64 * 1024, 16 * 1024, io_uring != 0);
+            using_io_uring = fs.isUsingIOUring();
+            MuxLikeWrite(fs, 100, payload);
+        }
+        printf("  AsyncFileStream (%s): %s\n", using_io_uring ? "io_uring" : "thread", CompareFile("AsyncFileStream.bin", expected) ? "ok" : "failed");
+    }
+
+    // small windows to exercise remapping and patches outside the current window
+    {
+        {
+            MappedFileStream fs("MappedFileStream.bin", 64 * 1024);
+            MuxLikeWrite(fs, 100, payload);
+        }
+        printf("  MappedFileStream: %s\n", CompareFile("MappedFileStream.bin", expected) ? "ok" : "failed");
+    }
+
+#ifdef __linux__
+    // every write to /dev/full fails with ENOSPC. the failure must be reported after flush().
+    {
+        bool ok = true;
+        {
+            FileStream fs("/dev/full", 4096);
+            MuxLikeWrite(fs, 10, payload);
+            fs.flush();
+            ok = ok && fs.failed();
+        }
+        for (int io_uring = 0; io_uring < 2; ++io_uring) {
+            AsyncFileStream fs("/dev/full", 64 * 1024, 16 * 1024, io_uring != 0);
+            MuxLikeWrite(fs, 10, payload);
+            fs.flush();
+            ok = ok && fs.failed();
+        }
+        printf("  write errors: %s\n", ok ? "ok" : "failed");
+    }
+#endif
+
+    // custom streams must produce the same data with far fewer callback calls
+    {
+        CustomStreamHost direct, combined, vectored;
+        {
+            // unbuffered: 1 callback call per write(), like before write combining
+            CustomStreamData csd;
+            csd.obj = &direct;
+            csd.tellp = &CustomStreamHost::tellp;
+            csd.seekp = &CustomStreamHost::seekp;
+            csd.write = &CustomStreamHost::write;
+            CustomStream cs(csd, 0);
+            MuxLikeWrite(cs, 100, payload);
+        }
+        fcStream *cs = fcCreateCustomStream(&combined, &CustomStreamHost::tellp, &CustomStreamHost::seekp, &CustomStreamHost::write);
+        fcStream *vs = fcCreateCustomStreamWritev(&vectored, &CustomStreamHost::tellp, &CustomStreamHost::seekp, &CustomStreamHost::write, &CustomStreamHost::writev);
+        MuxLikeWrite(*(BinaryStream*)cs, 100, payload);
+        MuxLikeWrite(*(BinaryStream*)vs, 100, payload);
+        fcStreamFlush(cs);
+        fcStreamFlush(vs);
+
+        bool ok = direct.buf.size() == expected.size() && memcmp(direct.buf.ptr(), expected.ptr(), expected.size()) == 0 &&
+            combined.buf.size() == expected.size() && memcmp(combined.buf.ptr(), expected.ptr(), expected.size()) == 0 &&
+            vectored.buf.size() == expected.size() && memcmp(vectored.buf.ptr(), expected.ptr(), expected.size()) == 0;
+        printf("  CustomStream: %s (callback calls: %d unbuffered, %d combined, %d combined + writev)\n",
+            ok ? "ok" : "failed", direct.num_calls, combined.num_calls, vectored.num_calls);
+        fcDestroyStream(cs);
+        fcDestroyStream(vs);
+    }
+
+    // a failing write callback must be visible: buffered data after flush, direct writes by the result of write()
+    {
+        CustomStreamHost host;
+        auto failing_write = [](void*, const void*, size_t) -> size_t { return 0; };
+        fcStream *cs = fcCreateCustomStream(&host, &CustomStreamHost::tellp, &CustomStreamHost::seekp, failing_write);
+        BinaryStream &os = *(BinaryStream*)cs;
+        bool ok = os.write(&payload[0], 100) == 100 && !fcStreamFailed(cs);
+        fcStreamFlush(cs);
+        ok = ok && fcStreamFailed(cs);
+        ok = ok && os.write(&payload[0], payload.size()) == payload.size(); // buffered
+        std::vector<char> large(CustomStream::DefaultBufferSize);
+        ok = ok && os.write(&large[0], large.size()) == 0; // passed to the callback directly
+        printf("  CustomStream write errors: %s\n", ok ? "ok" : "failed");
+        fcDestroyStream(cs);
+    }
+
+    // mp4 muxing throughput of each backend
+    {
+        StdIOStream os(new std::fstream("MuxBench_fstream.bin", std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc), true);
+        double bps = MuxBenchImpl(os, NumFrames, payload);
+        printf("  std::fstream: %.2f MB/sec\n", bps / (1024.0 * 1024.0));
+    }
+    {
+        FileStream os("MuxBench_FileStream.bin");
+        double bps = MuxBenchImpl(os, NumFrames, payload);
+        printf("  FileStream: %.2f MB/sec\n", bps / (1024.0 * 1024.0));
+    }
+    for (int io_uring = 0; io_uring < 2; ++io_uring) {
+        AsyncFileStream os("MuxBench_AsyncFileStream.bin", AsyncFileStream::DefaultMaxPendingBytes, AsyncFileStream::DefaultBlockSize, io_uring != 0);
+        double bps = MuxBenchImpl(os, NumFrames, payload);
+        printf("  AsyncFileStream (%s): %.2f MB/sec\n", os.isUsingIOUring() ? "io_uring" : "thread", bps / (1024.0 * 1024.0));
+    }
+    {
+        MappedFileStream os("MuxBench_MappedFileStream.bin");
+        double bps = MuxBenchImpl(os, NumFrames, payload);
+        printf("  MappedFileStream: %.2f MB/sec\n", bps / (1024.0 * 1024.0));
+    }
+
+    printf("StreamTest end\n");
+}
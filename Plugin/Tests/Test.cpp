@@ -5,7 +5,12 @@ void ExrTest();
 void GifTest();
 void MP4Test();
 void ConvertTest();
+void ConvertBench();
 void FAACSelfBuildTest();
+void ThreadPoolTest(const char *self_path);
+void ThreadPoolBench(int num_workers);
+void BufferTest();
+void StreamTest();
 
 int main(int argc, char *argv[])
 {
@@ -14,7 +19,12 @@ int main(int argc, char *argv[])
     bool gif = false;
     bool mp4 = false;
     bool convert = false;
+    bool convert_bench = false;
     bool faac = false;
+    bool threadpool = false;
+    int threadpool_bench_workers = 0;
+    bool buffer = false;
+    bool stream = false;
 
     if (argc <= 1) {
         png = exr = gif = mp4 = convert = true;
@@ -27,7 +37,12 @@ int main(int argc, char *argv[])
             else if (strstr(argv[i], "gif")) { gif = true; }
             else if (strstr(argv[i], "faac")) { faac = true; }
             else if (strstr(argv[i], "mp4")) { mp4 = true; }
+            else if (strstr(argv[i], "convertbench")) { convert_bench = true; }
             else if (strstr(argv[i], "convert")) { convert = true; }
+            else if (strstr(argv[i], "threadpoolbench=")) { threadpool_bench_workers = atoi(strchr(argv[i], '=') + 1); }
+            else if (strstr(argv[i], "threadpool")) { threadpool = true; }
+            else if (strstr(argv[i], "buffer")) { buffer = true; }
+            else if (strstr(argv[i], "stream")) { stream = true; }
         }
     }
 
@@ -36,5 +51,10 @@ int main(int argc, char *argv[])
     if (gif) GifTest();
     if (mp4) MP4Test();
     if (convert) ConvertTest();
+    if (convert_bench) ConvertBench();
     if (faac) FAACSelfBuildTest();
+    if (threadpool) ThreadPoolTest(argv[0]);
+    if (threadpool_bench_workers > 0) ThreadPoolBench(threadpool_bench_workers);
+    if (buffer) BufferTest();
+    if (stream) StreamTest();
 }
@@ -0,0 +1,139 @@
+#include "TestCommon.h"
+
+
+// measure task throughput of fcThreadPool while the number of submitting threads grows.
+// each submitter runs its own fcTaskGroup, just like concurrently running png / exr / gif contexts.
+static double ThreadPoolBenchImpl(int num_submitters, int tasks_per_submitter)
+{
+    std::atomic_int sink(0);
+    auto task = [&sink]() {
+        int v = 0;
+        for (int i = 0; i < 256; ++i) { v += i * i; }
+        sink += v & 1;
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> submitters;
+    for (int si = 0; si < num_submitters; ++si) {
+        submitters.emplace_back([&]() {
+            fcTaskGroup group;
+            for (int i = 0; i < tasks_per_submitter; ++i) {
+                group.run(task);
+            }
+            group.wait();
+        });
+    }
+    for (auto& t : submitters) { t.join(); }
+    auto end = std::chrono::steady_clock::now();
+
+    double sec = std::chrono::duration<double>(end - begin).count();
+    return double(num_submitters * tasks_per_submitter) / sec;
+}
+
+// throughput of a pool with num_workers workers, while the number of submitting threads grows.
+// the pool is created once per process, so ThreadPoolTest() runs this in a child process for each worker count.
+void ThreadPoolBench(int num_workers)
+{
+    const int TasksPerSubmitter = 100000;
+    int max_submitters = std::max<int>(std::thread::hardware_concurrency(), 1);
+
+    fcThreadPoolConfig conf;
+    conf.num_workers = num_workers;
+    if (!fcSetWorkerThreadConfig(conf)) { return; }
+
+    ThreadPoolBenchImpl(1, TasksPerSubmitter); // warm up
+    for (int n = 1; ; n *= 2) {
+        n = std::min<int>(n, max_submitters);
+        double tps = ThreadPoolBenchImpl(n, TasksPerSubmitter);
+        printf("  %2d workers, %2d submitters: %.2f M tasks/sec\n", num_workers, n, tps / 1000000.0);
+        if (n == max_submitters) { break; }
+    }
+}
+
+// self_path: path of the test executable, to run ThreadPoolBench() with each worker count
+void ThreadPoolTest(const char *self_path)
+{
+    printf("ThreadPoolTest begin\n");
+
+    int max_submitters = std::max<int>(std::thread::hardware_concurrency(), 1);
+
+    // nested task groups (tasks that spawn tasks) must complete
+    {
+        std::atomic_int count(0);
+        fcTaskGroup outer;
+        for (int i = 0; i < 16; ++i) {
+            outer.run([&count]() {
+                fcTaskGroup inner;
+                for (int j = 0; j < 16; ++j) {
+                    inner.run([&count]() { ++count; });
+                }
+                inner.wait();
+            });
+        }
+        outer.wait();
+        printf("  nested tasks: %d / %d\n", (int)count, 16 * 16);
+    }
+
+    // wait_for() must give up when tasks take longer than the timeout
+    {
+        fcTaskGroup group;
+        group.run([]() { std::this_thread::sleep_for(std::chrono::milliseconds(200)); });
+        bool finished_early = group.wait_for(10);
+        bool finished_late = group.wait_for(1000);
+        printf("  wait_for: %s\n", !finished_early && finished_late ? "ok" : "failed");
+    }
+
+    // a realtime task must not wait for long background tasks (requires 2 or more workers)
+    {
+        fcTaskGroup background, realtime;
+        for (int i = 0; i < max_submitters * 2; ++i) {
+            background.run([]() { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }, fcTaskPriority_Background);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        auto begin = std::chrono::steady_clock::now();
+        realtime.run([]() {}, fcTaskPriority_Realtime);
+        realtime.wait_for(1000); // wait() would run the task on this thread
+        auto end = std::chrono::steady_clock::now();
+        background.wait();
+        printf("  realtime latency under background load: %.2f ms\n", std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+
+    // fcFreeList must never hand out an item twice
+    {
+        const int NumItems = 4;
+        std::vector<std::atomic_int> items(NumItems);
+        fcFreeList<std::atomic_int> free_list;
+        free_list.reset(items.data(), NumItems);
+
+        std::atomic_int num_errors(0);
+        std::vector<std::thread> threads;
+        for (int ti = 0; ti < 8; ++ti) {
+            threads.emplace_back([&]() {
+                for (int i = 0; i < 10000; ++i) {
+                    std::atomic_int *item = free_list.acquire();
+                    if (++*item != 1) { ++num_errors; }
+                    --*item;
+                    free_list.release(item);
+                }
+            });
+        }
+        for (auto& t : threads) { t.join(); }
+        printf("  free list: %s\n", num_errors == 0 && free_list.tryAcquire() ? "ok" : "failed");
+    }
+
+    // throughput as the core count grows: 1, 2, 4 ... hardware_concurrency() workers
+    fflush(stdout);
+    int max_workers = std::max<int>(std::thread::hardware_concurrency(), 1);
+    for (int n = 1; ; n *= 2) {
+        n = std::min<int>(n, max_workers);
+        char command[1024];
+        sprintf(command, "\"%s\" threadpoolbench=%d", self_path, n);
+        if (std::system(command) != 0) {
+            printf("  %2d workers: failed to run \"%s\"\n", n, command);
+        }
+        if (n == max_workers) { break; }
+    }
+
+    printf("ThreadPoolTest end\n");
+}